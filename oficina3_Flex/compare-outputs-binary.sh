@@ -0,0 +1,10 @@
+#!/bin/bash
+for f in lua-examples/*.lua
+do
+	new="$(echo $f | perl -pe 's/(.+\/)(.+)\.lua/\2\.out/')"
+	bin="$(echo $f | perl -pe 's/(.+\/)(.+)\.lua/\2\.tokbin/')"
+	echo "####### Comparando saida binaria de $f com reference-outputs/$new" ... 
+	./lua-lexer -b < $f > outputs/$bin
+	./tokens-to-text outputs/$bin | diff reference-outputs/$new -
+	echo "####### Done ... ###########"
+done
\ No newline at end of file
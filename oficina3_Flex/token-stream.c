@@ -0,0 +1,236 @@
+/* token-stream.c: compact binary format for the token stream of lua-lexer */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "token-stream.h"
+
+static const uint32_t Pool_index_empty = UINT32_MAX;
+
+/* --- Writer */
+
+bool token_writer_init(token_writer_t *writer) {
+    memset(writer, 0, sizeof(token_writer_t));
+    writer->tokens_max = 1024;
+    writer->tokens = malloc(writer->tokens_max*sizeof(token_record_t));
+    writer->pool_max = 64*1024;
+    writer->pool = malloc(writer->pool_max);
+    writer->pool_index_max = 1024;
+    writer->pool_index = malloc(writer->pool_index_max*sizeof(uint32_t));
+    if (writer->tokens == NULL || writer->pool == NULL || writer->pool_index == NULL) {
+        return false;
+    }
+    memset(writer->pool_index, 0xFF, writer->pool_index_max*sizeof(uint32_t));
+    return true;
+}
+
+// FNV-1a
+static uint32_t text_hash(const char *text, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i=0; i<length; i++) {
+        hash ^= (unsigned char) text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Finds the slot of text in the index of the pool: either the slot where it is
+// stored or the empty slot where it should be inserted
+static size_t pool_find(token_writer_t *writer, const char *text, size_t length) {
+    size_t mask = writer->pool_index_max - 1;
+    size_t slot = text_hash(text, length) & mask;
+    while (writer->pool_index[slot] != Pool_index_empty) {
+        const char *stored = writer->pool + writer->pool_index[slot];
+        if (strncmp(stored, text, length) == 0 && stored[length] == '\0') {
+            break;
+        }
+        slot = (slot+1) & mask;
+    }
+    return slot;
+}
+
+static bool pool_grow_index(token_writer_t *writer) {
+    uint32_t *old_index = writer->pool_index;
+    size_t    old_max   = writer->pool_index_max;
+    writer->pool_index_max *= 2;
+    writer->pool_index = malloc(writer->pool_index_max*sizeof(uint32_t));
+    if (writer->pool_index == NULL) {
+        free(old_index);
+        return false;
+    }
+    memset(writer->pool_index, 0xFF, writer->pool_index_max*sizeof(uint32_t));
+    for (size_t i=0; i<old_max; i++) {
+        if (old_index[i] != Pool_index_empty) {
+            const char *text = writer->pool + old_index[i];
+            writer->pool_index[pool_find(writer, text, strlen(text))] = old_index[i];
+        }
+    }
+    free(old_index);
+    return true;
+}
+
+// Stores text in the pool, if not already there, and returns its offset
+static bool pool_add(token_writer_t *writer, const char *text, size_t length,
+                     uint32_t *offset) {
+    size_t slot = pool_find(writer, text, length);
+    if (writer->pool_index[slot] != Pool_index_empty) {
+        *offset = writer->pool_index[slot];
+        return true;
+    }
+    size_t pool_size = writer->header.pool_size;
+    if (pool_size+length+1 >= UINT32_MAX) {
+        return false;
+    }
+    while (pool_size+length+1 > writer->pool_max) {
+        writer->pool_max *= 2;
+        writer->pool = realloc(writer->pool, writer->pool_max);
+        if (writer->pool == NULL) {
+            return false;
+        }
+    }
+    memcpy(writer->pool+pool_size, text, length);
+    writer->pool[pool_size+length] = '\0';
+    writer->pool_index[slot] = pool_size;
+    writer->pool_index_n++;
+    writer->header.pool_size = pool_size+length+1;
+    *offset = pool_size;
+    if (2*writer->pool_index_n > writer->pool_index_max) {
+        return pool_grow_index(writer);
+    }
+    return true;
+}
+
+bool token_writer_add(token_writer_t *writer, int line, int kind,
+                      const char *content, const char *string) {
+    if (writer->header.tokens_n == 0) {
+        writer->header.first_line = line;
+        writer->last_line = line;
+    }
+    uint32_t delta = line - writer->last_line;
+    if (line < writer->last_line || delta > Token_max_delta || kind < 0 ||
+        kind >= (1 << Token_kind_bits) || writer->header.tokens_n == UINT32_MAX) {
+        return false;
+    }
+    writer->last_line = line;
+
+    if (writer->header.tokens_n == writer->tokens_max) {
+        writer->tokens_max *= 2;
+        writer->tokens = realloc(writer->tokens, writer->tokens_max*sizeof(token_record_t));
+        if (writer->tokens == NULL) {
+            return false;
+        }
+    }
+    token_record_t *token = &writer->tokens[writer->header.tokens_n];
+    token->kind_delta = kind | (delta << Token_kind_bits);
+    token->content_length = strlen(content);
+    if (!pool_add(writer, content, token->content_length, &token->content_offset)) {
+        return false;
+    }
+    token->string_offset = Token_no_string;
+    token->string_length = 0;
+    if (string != NULL) {
+        token->string_length = strlen(string);
+        if (!pool_add(writer, string, token->string_length, &token->string_offset)) {
+            return false;
+        }
+    }
+    writer->header.tokens_n++;
+    return true;
+}
+
+bool token_writer_finish(token_writer_t *writer, FILE *output) {
+    memcpy(writer->header.magic, TOKEN_STREAM_MAGIC, sizeof(writer->header.magic));
+    writer->header.version = TOKEN_STREAM_VERSION;
+    fwrite(&writer->header, sizeof(token_stream_header_t), 1, output);
+    fwrite(writer->tokens, sizeof(token_record_t), writer->header.tokens_n, output);
+    fwrite(writer->pool, 1, writer->header.pool_size, output);
+    free(writer->tokens);
+    free(writer->pool);
+    free(writer->pool_index);
+    return fflush(output) == 0 && !ferror(output);
+}
+
+/* --- Reader */
+
+bool token_stream_open(token_stream_t *stream, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) < 0 || file_stat.st_size < sizeof(token_stream_header_t)) {
+        close(fd);
+        return false;
+    }
+    stream->size = file_stat.st_size;
+    void *mapping = mmap(NULL, stream->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    stream->header = mapping;
+    stream->tokens = (const token_record_t *) (stream->header+1);
+    stream->pool   = (const char *) (stream->tokens+stream->header->tokens_n);
+
+    // Checks the header and that every text is inside the pool
+    const token_stream_header_t *header = stream->header;
+    bool valid = memcmp(header->magic, TOKEN_STREAM_MAGIC, sizeof(header->magic)) == 0 &&
+                 header->version == TOKEN_STREAM_VERSION &&
+                 stream->size == sizeof(token_stream_header_t) +
+                                 (size_t) header->tokens_n*sizeof(token_record_t) +
+                                 header->pool_size;
+    for (uint32_t i=0; valid && i<header->tokens_n; i++) {
+        const token_record_t *token = &stream->tokens[i];
+        valid = (uint64_t) token->content_offset+token->content_length < header->pool_size &&
+                stream->pool[token->content_offset+token->content_length] == '\0';
+        if (valid && token->string_offset != Token_no_string) {
+            valid = (uint64_t) token->string_offset+token->string_length < header->pool_size &&
+                    stream->pool[token->string_offset+token->string_length] == '\0';
+        }
+    }
+    if (!valid) {
+        munmap(mapping, stream->size);
+        return false;
+    }
+    return true;
+}
+
+void token_stream_close(token_stream_t *stream) {
+    munmap((void *) stream->header, stream->size);
+}
+
+/* --- Text format */
+
+void token_print(FILE *output, int line, int kind, const char *content,
+                 const char *string, size_t string_size) {
+    /* Prints basic info about the token */
+    fprintf(output, "line %d - token: %d - content: %s\n", line, kind, content);
+
+    /* Prints contents of string, cut to fit in line */
+    if (string != NULL) {
+        const size_t Max_line_width = 100;
+        char line[Max_line_width+1];
+        strcpy(line, "");
+        char *message = "    string content: ";
+        size_t printed = 0;
+        while (true) {
+            printed += strlen(line);
+            if (printed >= string_size) {
+                break;
+            }
+            const int Line_width = Max_line_width - strlen(message);
+            strncpy(line, string+printed, Line_width);
+            line[Line_width] = '\0';
+            fprintf(output, "%s%s\n", message, line);
+            message = "    ";
+        }
+    }
+}
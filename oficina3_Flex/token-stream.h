@@ -0,0 +1,101 @@
+/* token-stream.h: compact binary format for the token stream of lua-lexer
+
+   A token stream file has a header, a fixed-size record per token, and a pool
+   with the (deduplicated, null-terminated) texts of the tokens, in that order,
+   so a reader can map the whole file and use it in place. Numbers are stored
+   in the byte order of the machine that wrote the file. */
+
+#ifndef TOKEN_STREAM_H
+#define TOKEN_STREAM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define TOKEN_STREAM_MAGIC   "LUATOKS"
+#define TOKEN_STREAM_VERSION 1
+
+typedef struct token_stream_header_t {
+    char     magic[8];
+    uint32_t version;
+    uint32_t tokens_n;
+    uint32_t first_line;  // line of the first token; the others are deltas
+    uint32_t pool_size;
+} token_stream_header_t;
+
+// Token kind in the low 8 bits, line delta from the previous token in the
+// upper 24 bits
+#define Token_kind_bits  8
+#define Token_max_delta  ((UINT32_C(1) << (32-Token_kind_bits)) - 1)
+// string_offset of tokens that are not strings
+#define Token_no_string  UINT32_MAX
+
+typedef struct token_record_t {
+    uint32_t kind_delta;
+    uint32_t content_offset;  // yytext of the token, in the pool
+    uint32_t content_length;
+    uint32_t string_offset;   // contents of string tokens, in the pool
+    uint32_t string_length;
+} token_record_t;
+
+static inline int token_kind(const token_record_t *token) {
+    return token->kind_delta & ((1 << Token_kind_bits) - 1);
+}
+
+static inline uint32_t token_line_delta(const token_record_t *token) {
+    return token->kind_delta >> Token_kind_bits;
+}
+
+/* --- Writer: accumulates the tokens in memory, writes the file at the end */
+
+typedef struct token_writer_t {
+    token_stream_header_t header;
+    token_record_t *tokens;
+    size_t          tokens_max;
+    char           *pool;
+    size_t          pool_max;
+    uint32_t       *pool_index;  // hash table of offsets of texts in the pool
+    size_t          pool_index_max;
+    size_t          pool_index_n;
+    int             last_line;
+} token_writer_t;
+
+// All functions return false if there is not enough memory or the output fails
+bool token_writer_init(token_writer_t *writer);
+// Adds a token; string should be NULL for tokens that are not strings
+bool token_writer_add(token_writer_t *writer, int line, int kind,
+                      const char *content, const char *string);
+bool token_writer_finish(token_writer_t *writer, FILE *output);
+
+/* --- Reader: maps a token stream file */
+
+typedef struct token_stream_t {
+    const token_stream_header_t *header;
+    const token_record_t        *tokens;
+    const char                  *pool;
+    size_t                       size;  // of the whole mapping
+} token_stream_t;
+
+// Returns false if the file cannot be mapped or is not a valid token stream
+bool token_stream_open(token_stream_t *stream, const char *path);
+void token_stream_close(token_stream_t *stream);
+
+static inline const char *token_content(const token_stream_t *stream,
+                                        const token_record_t *token) {
+    return stream->pool + token->content_offset;
+}
+
+// Returns NULL for tokens that are not strings
+static inline const char *token_string(const token_stream_t *stream,
+                                       const token_record_t *token) {
+    return token->string_offset == Token_no_string ? NULL
+                                                   : stream->pool + token->string_offset;
+}
+
+/* --- Text format, the same printed by lua-lexer */
+
+// Prints one token; string should be NULL for tokens that are not strings
+void token_print(FILE *output, int line, int kind, const char *content,
+                 const char *string, size_t string_size);
+
+#endif
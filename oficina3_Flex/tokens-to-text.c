@@ -0,0 +1,32 @@
+/* tokens-to-text.c: converts a binary token stream (lua-lexer -b) back to the
+   text format printed by lua-lexer */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "token-stream.h"
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: tokens-to-text <input.tokbin>\n"
+                        "prints a binary token stream in the text format of lua-lexer\n");
+        return EXIT_FAILURE;
+    }
+
+    token_stream_t stream;
+    if (!token_stream_open(&stream, argv[1])) {
+        fprintf(stderr, "error opening token stream: %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    int line = stream.header->first_line;
+    for (uint32_t i=0; i<stream.header->tokens_n; i++) {
+        const token_record_t *token = &stream.tokens[i];
+        line += token_line_delta(token);
+        token_print(stdout, line, token_kind(token), token_content(&stream, token),
+                    token_string(&stream, token), token->string_length);
+    }
+
+    token_stream_close(&stream);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,858 @@
+#include <ctype.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arithmetic-formulas.h"
+#include "arithmetic.tab.h"
+
+static void *check_alloc(void *pointer) {
+    if (pointer == NULL) {
+        fprintf(stderr, "out of memory!\n");
+        exit(EXIT_FAILURE);
+    }
+    return pointer;
+}
+
+/* --- Expression nodes */
+
+struct node_t {
+    int     operation;  // NUMBER, IDENTIFIER, UMINUS, or the token of the operator
+    int     value;      // constant for NUMBER, symbol index for IDENTIFIER
+    node_t *operands[3];
+    // Result of the node in evaluation pass evaluated_pass
+    unsigned evaluated_pass;
+    bool     evaluated_ok;
+    int      evaluated_value;
+    unsigned visited;   // for traversals of the DAG
+    // Compiled program of the formula with this node as root, for columns
+    struct program_t *program;
+    int               slot;  // while compiling
+};
+
+// Operation of the nodes that read a column directly (value is its index)
+#define COLUMN (-1)
+
+// Interned nodes, in an open addressing hash table of 2^n entries
+static node_t **nodes;
+static size_t   nodes_n, nodes_max;
+
+static size_t node_hash(int operation, int value, node_t *const operands[3]) {
+    uint64_t hash = (uint32_t) operation * UINT64_C(0x9E3779B97F4A7C15) ^ (uint32_t) value;
+    for (int i=0; i<3; i++) {
+        hash = (hash ^ (uintptr_t) operands[i]) * UINT64_C(0x100000001B3);
+    }
+    return hash ^ (hash >> 29);
+}
+
+static void nodes_grow(void) {
+    node_t **old_nodes = nodes;
+    size_t old_max = nodes_max;
+    nodes_max = nodes_max ? 2*nodes_max : 1024;
+    nodes = check_alloc(calloc(nodes_max, sizeof(node_t *)));
+    for (size_t i=0; i<old_max; i++) {
+        if (old_nodes[i] != NULL) {
+            size_t index = node_hash(old_nodes[i]->operation, old_nodes[i]->value, old_nodes[i]->operands);
+            while (nodes[index & (nodes_max-1)] != NULL) {
+                index++;
+            }
+            nodes[index & (nodes_max-1)] = old_nodes[i];
+        }
+    }
+    free(old_nodes);
+}
+
+static node_t *node_intern(int operation, int value, node_t *op1, node_t *op2, node_t *op3) {
+    node_t *const operands[3] = {op1, op2, op3};
+    if (2*(nodes_n+1) > nodes_max) {
+        nodes_grow();
+    }
+    size_t index = node_hash(operation, value, operands) & (nodes_max-1);
+    while (nodes[index] != NULL) {
+        node_t *node = nodes[index];
+        if (node->operation == operation && node->value == value
+                && memcmp(node->operands, operands, sizeof(operands)) == 0) {
+            return node;
+        }
+        index = (index+1) & (nodes_max-1);
+    }
+    node_t *node = check_alloc(calloc(1, sizeof(node_t)));
+    node->operation = operation;
+    node->value = value;
+    memcpy(node->operands, operands, sizeof(operands));
+    nodes[index] = node;
+    nodes_n++;
+    return node;
+}
+
+node_t *node_number(int value) {
+    return node_intern(NUMBER, value, NULL, NULL, NULL);
+}
+
+node_t *node_symbol(int symbol) {
+    return node_intern(IDENTIFIER, symbol, NULL, NULL, NULL);
+}
+
+// Applies operation to the values of its operands, returns false on division by zero
+static bool apply(int operation, const int operand[3], int *result) {
+    int a = operand[0], b = operand[1];
+    switch (operation) {
+        case '+':    *result = a + b;  break;
+        case '-':    *result = a - b;  break;
+        case '*':    *result = a * b;  break;
+        case '/':    if (b == 0) return false; *result = a / b; break;
+        case '%':    if (b == 0) return false; *result = a % b; break;
+        case UMINUS: *result = -a;     break;
+        case '|':    *result = a | b;  break;
+        case '^':    *result = a ^ b;  break;
+        case '&':    *result = a & b;  break;
+        case '~':    *result = ~a;     break;
+        case EQ:     *result = a == b ? -1 : 0; break;
+        case NE:     *result = a != b ? -1 : 0; break;
+        case GT:     *result = a >  b ? -1 : 0; break;
+        case GE:     *result = a >= b ? -1 : 0; break;
+        case LT:     *result = a <  b ? -1 : 0; break;
+        case LE:     *result = a <= b ? -1 : 0; break;
+        case '?':    *result = a ? b : operand[2]; break;
+    }
+    return true;
+}
+
+node_t *node_operation(int operation, node_t *op1, node_t *op2, node_t *op3) {
+    node_t *const operands[3] = {op1, op2, op3};
+    int values[3] = {0, 0, 0};
+    bool constant = true;
+    for (int i=0; i<3 && operands[i] != NULL; i++) {
+        constant = constant && operands[i]->operation == NUMBER;
+        values[i] = operands[i]->value;
+    }
+    int result;
+    if (constant && apply(operation, values, &result)) {
+        return node_number(result);
+    }
+    // A division by zero is kept, to be reported whenever the formula is evaluated
+    return node_intern(operation, 0, op1, op2, op3);
+}
+
+/* --- Evaluation */
+
+static unsigned evaluation_pass = 0;
+
+static bool check_zero(int value) {
+    if (value == 0) {
+        fprintf(stderr, "division by zero!\n");
+        return true;
+    }
+    return false;
+}
+
+// Evaluates node in the current pass: shared nodes are evaluated only once
+static bool node_evaluate(node_t *node, int *value) {
+    if (node->evaluated_pass == evaluation_pass) {
+        *value = node->evaluated_value;
+        return node->evaluated_ok;
+    }
+    bool ok = true;
+    int values[3] = {0, 0, 0};
+    if (node->operation == NUMBER) {
+        *value = node->value;
+    }
+    else if (node->operation == IDENTIFIER) {
+        *value = symbol_value(node->value);
+    }
+    else if (node->operation == '?') {
+        // Only the chosen alternative is evaluated
+        ok = node_evaluate(node->operands[0], &values[0])
+          && node_evaluate(node->operands[values[0] ? 1 : 2], value);
+    }
+    else {
+        for (int i=0; i<3 && ok && node->operands[i] != NULL; i++) {
+            ok = node_evaluate(node->operands[i], &values[i]);
+        }
+        if (ok && (node->operation == '/' || node->operation == '%')) {
+            ok = !check_zero(values[1]);
+        }
+        if (ok) {
+            apply(node->operation, values, value);
+        }
+    }
+    node->evaluated_pass = evaluation_pass;
+    node->evaluated_ok = ok;
+    node->evaluated_value = *value;
+    return ok;
+}
+
+/* --- Symbol table */
+
+typedef struct symbol_t {
+    char   *name;
+    int     value;
+    int     column;      // index of the value of column variables, otherwise -1
+    node_t *formula;
+    int    *references;  // variables read by the formula, without repetitions
+    size_t  references_n;
+    int    *dependents;  // variables whose formulas read this one
+    size_t  dependents_n, dependents_max;
+    unsigned visited, referenced;  // for traversals of the dependencies
+} symbol_t;
+
+static symbol_t *symbols;
+static size_t    symbols_n, symbols_max;
+
+// Indexes of the symbols (or -1), by the hash of their names, with open addressing
+static int    *symbol_table;
+static size_t  symbol_table_size = 0;
+
+static size_t symbol_hash(const char *symbol_name) {
+    uint64_t hash = 0x18462937; // random value
+    for (int i=0; symbol_name[i]!='\0'; i++) {
+        hash ^= symbol_name[i];
+        hash = (hash << 5) | (hash >> (sizeof(hash)*8-5)); // rol(hash, 5)
+    }
+    // Mixes the high bits into the low ones, which select the slot
+    hash *= UINT64_C(0x9E3779B97F4A7C15);
+    return hash ^ (hash >> 32);
+}
+
+// Finds the slot of symbol_name in the symbol table: either its index, or -1
+static size_t symbol_slot(const char *symbol_name) {
+    size_t index = symbol_hash(symbol_name) % symbol_table_size;
+    while (symbol_table[index] >= 0 && strcmp(symbols[symbol_table[index]].name, symbol_name) != 0) {
+        index = (index+1) % symbol_table_size;
+    }
+    return index;
+}
+
+static void symbol_table_grow(void) {
+    free(symbol_table);
+    symbol_table_size = symbol_table_size ? 2*symbol_table_size : 1024;
+    symbol_table = check_alloc(malloc(symbol_table_size*sizeof(int)));
+    memset(symbol_table, -1, symbol_table_size*sizeof(int));
+    for (size_t symbol=0; symbol<symbols_n; symbol++) {
+        symbol_table[symbol_slot(symbols[symbol].name)] = symbol;
+    }
+}
+
+bool get_symbol(const char *symbol_name, int *symbol) {
+    if (symbol_table_size > 0) {
+        *symbol = symbol_table[symbol_slot(symbol_name)];
+        if (*symbol >= 0) {
+            return true;
+        }
+    }
+    fprintf(stderr, "undefined variable: %s\n", symbol_name);
+    return false;
+}
+
+int symbol_value(int symbol) {
+    return symbols[symbol].value;
+}
+
+static int symbol_new(char *symbol_name) {
+    if (4*(symbols_n+1) > 3*symbol_table_size) {
+        symbol_table_grow();
+    }
+    if (symbols_n == symbols_max) {
+        symbols_max = symbols_max ? 2*symbols_max : 1024;
+        symbols = check_alloc(realloc(symbols, symbols_max*sizeof(symbol_t)));
+    }
+    int symbol = symbols_n++;
+    symbols[symbol] = (symbol_t) { .name = symbol_name, .column = -1 };
+    symbol_table[symbol_slot(symbol_name)] = symbol;
+    return symbol;
+}
+
+// Mark of the nodes and symbols seen in the current traversal
+static unsigned visit_mark = 0;
+
+/* --- Columns */
+
+typedef struct column_t {
+    int  *values;
+    int  *invalid;  // -1 in the rows where the value could not be computed, otherwise 0
+    bool  pinned;   // read by a node, and so never released
+} column_t;
+
+static column_t *columns;
+static size_t    columns_n, columns_max;
+static size_t    rows_n = 0;
+
+static int column_new(void) {
+    if (columns_n == columns_max) {
+        columns_max = columns_max ? 2*columns_max : 64;
+        columns = check_alloc(realloc(columns, columns_max*sizeof(column_t)));
+    }
+    column_t *column = &columns[columns_n];
+    column->values = check_alloc(malloc((rows_n+1)*sizeof(int)));
+    column->invalid = check_alloc(calloc(rows_n+1, sizeof(int)));
+    column->pinned = false;
+    return columns_n++;
+}
+
+static void column_release(int column) {
+    if (column >= 0 && !columns[column].pinned) {
+        free(columns[column].values);
+        free(columns[column].invalid);
+        columns[column].values = columns[column].invalid = NULL;
+    }
+}
+
+static node_t *node_column(int column) {
+    columns[column].pinned = true;
+    return node_intern(COLUMN, column, NULL, NULL, NULL);
+}
+
+static bool reads_columns_(node_t *node) {
+    if (node->visited == visit_mark) {
+        return false;
+    }
+    node->visited = visit_mark;
+    if (node->operation == COLUMN || (node->operation == IDENTIFIER && symbols[node->value].column >= 0)) {
+        return true;
+    }
+    for (int i=0; i<3 && node->operands[i] != NULL; i++) {
+        if (reads_columns_(node->operands[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool reads_columns(node_t *formula) {
+    if (columns_n == 0) {
+        return false;
+    }
+    visit_mark++;
+    return reads_columns_(formula);
+}
+
+/* --- Programs: the nodes of a formula in an order where operands come first,
+       each leaving its value for a block of rows in a slot */
+
+#define Block_rows 1024
+
+typedef struct instruction_t {
+    int operation;
+    int value;
+    int operands[3];  // slots
+} instruction_t;
+
+typedef struct program_t {
+    instruction_t *instructions;
+    int            instructions_n;
+    // Value and invalid rows of each slot for the current block, either in
+    // the buffers of the program or in a column
+    const int    **values;
+    const int    **invalid;
+    int           *buffers;
+} program_t;
+
+static void program_add(program_t *program, node_t *node) {
+    if (node->visited == visit_mark) {
+        return;
+    }
+    node->visited = visit_mark;
+    instruction_t instruction = { node->operation, node->value, {-1, -1, -1} };
+    for (int i=0; i<3 && node->operands[i] != NULL; i++) {
+        program_add(program, node->operands[i]);
+        instruction.operands[i] = node->operands[i]->slot;
+    }
+    node->slot = program->instructions_n;
+    program->instructions[program->instructions_n++] = instruction;
+}
+
+static int count_nodes(node_t *node) {
+    if (node->visited == visit_mark) {
+        return 0;
+    }
+    node->visited = visit_mark;
+    int n = 1;
+    for (int i=0; i<3 && node->operands[i] != NULL; i++) {
+        n += count_nodes(node->operands[i]);
+    }
+    return n;
+}
+
+static program_t *program_compile(node_t *formula) {
+    program_t *program = check_alloc(calloc(1, sizeof(program_t)));
+    visit_mark++;
+    int nodes_n = count_nodes(formula);
+    program->instructions = check_alloc(malloc(nodes_n*sizeof(instruction_t)));
+    visit_mark++;
+    program_add(program, formula);
+    program->values = check_alloc(malloc(nodes_n*sizeof(int *)));
+    program->invalid = check_alloc(malloc(nodes_n*sizeof(int *)));
+    program->buffers = check_alloc(malloc(2*nodes_n*Block_rows*sizeof(int)));
+    return program;
+}
+
+static const int No_invalid_rows[Block_rows];
+
+static void fill(int *values, int value) {
+    for (int i=0; i<Block_rows; i++) {
+        values[i] = value;
+    }
+}
+
+// Applies operation to n rows of its operands (b and c may repeat a, if not used);
+// all lanes are computed, and invalid lanes only propagate to the result
+static void run_operation(int operation, int n, int *restrict r, int *restrict r_invalid,
+                          const int *restrict a, const int *restrict a_invalid,
+                          const int *restrict b, const int *restrict b_invalid,
+                          const int *restrict c, const int *restrict c_invalid) {
+    #define Lanes(expression) for (int i=0; i<n; i++) { r[i] = (expression); } break;
+    switch (operation) {
+        case '+':    Lanes(a[i] + b[i])
+        case '-':    Lanes(a[i] - b[i])
+        case '*':    Lanes(a[i] * b[i])
+        case UMINUS: Lanes(-a[i])
+        case '|':    Lanes(a[i] | b[i])
+        case '^':    Lanes(a[i] ^ b[i])
+        case '&':    Lanes(a[i] & b[i])
+        case '~':    Lanes(~a[i])
+        case EQ:     Lanes(-(a[i] == b[i]))
+        case NE:     Lanes(-(a[i] != b[i]))
+        case GT:     Lanes(-(a[i] >  b[i]))
+        case GE:     Lanes(-(a[i] >= b[i]))
+        case LT:     Lanes(-(a[i] <  b[i]))
+        case LE:     Lanes(-(a[i] <= b[i]))
+        case '?':
+            for (int i=0; i<n; i++) {
+                r[i] = a[i] ? b[i] : c[i];
+                r_invalid[i] = a_invalid[i] | (a[i] ? b_invalid[i] : c_invalid[i]);
+            }
+            return;
+        case '/':
+        case '%':
+            // Lanes dividing by zero (or by -1, which overflows for INT_MIN)
+            // divide by 1 instead
+            for (int i=0; i<n; i++) {
+                int zero = b[i] == 0, minus_one = b[i] == -1;
+                int divisor = zero | minus_one ? 1 : b[i];
+                int negated = (int) (0u - (unsigned) a[i]);
+                if (operation == '/') {
+                    r[i] = minus_one ? negated : a[i] / divisor;
+                }
+                else {
+                    r[i] = minus_one ? 0 : a[i] % divisor;
+                }
+                r_invalid[i] = a_invalid[i] | b_invalid[i] | -zero;
+            }
+            return;
+    }
+    #undef Lanes
+    for (int i=0; i<n; i++) {
+        r_invalid[i] = a_invalid[i] | b_invalid[i];
+    }
+}
+
+// Evaluates formula (which reads columns) in all rows, into a new column
+static int column_evaluate(node_t *formula) {
+    if (formula->program == NULL) {
+        formula->program = program_compile(formula);
+    }
+    program_t *program = formula->program;
+    int result = column_new();
+
+    // Constants and scalar variables have the same value in all rows
+    for (int slot=0; slot<program->instructions_n; slot++) {
+        instruction_t *instruction = &program->instructions[slot];
+        int *buffer = &program->buffers[2*slot*Block_rows];
+        if (instruction->operation == NUMBER) {
+            fill(buffer, instruction->value);
+        }
+        else if (instruction->operation == IDENTIFIER && symbols[instruction->value].column < 0) {
+            fill(buffer, symbols[instruction->value].value);
+        }
+        else {
+            continue;
+        }
+        program->values[slot] = buffer;
+        program->invalid[slot] = No_invalid_rows;
+    }
+
+    for (size_t start=0; start<rows_n; start+=Block_rows) {
+        int n = rows_n-start < Block_rows ? rows_n-start : Block_rows;
+        for (int slot=0; slot<program->instructions_n; slot++) {
+            instruction_t *instruction = &program->instructions[slot];
+            int column = instruction->operation == COLUMN ? instruction->value
+                       : instruction->operation == IDENTIFIER ? symbols[instruction->value].column
+                       : -1;
+            if (column >= 0) {
+                program->values[slot] = columns[column].values + start;
+                program->invalid[slot] = columns[column].invalid + start;
+            }
+            else if (instruction->operation != NUMBER && instruction->operation != IDENTIFIER) {
+                int *buffer = &program->buffers[2*slot*Block_rows];
+                const int *operand[3], *operand_invalid[3];
+                for (int i=0; i<3; i++) {
+                    int operand_slot = instruction->operands[i] >= 0 ? instruction->operands[i] : instruction->operands[0];
+                    operand[i] = program->values[operand_slot];
+                    operand_invalid[i] = program->invalid[operand_slot];
+                }
+                run_operation(instruction->operation, n, buffer, buffer+Block_rows,
+                              operand[0], operand_invalid[0], operand[1], operand_invalid[1],
+                              operand[2], operand_invalid[2]);
+                program->values[slot] = buffer;
+                program->invalid[slot] = buffer+Block_rows;
+            }
+        }
+        int last = program->instructions_n-1;
+        memcpy(columns[result].values+start, program->values[last], n*sizeof(int));
+        memcpy(columns[result].invalid+start, program->invalid[last], n*sizeof(int));
+    }
+    return result;
+}
+
+// Computes the value of formula in the current evaluation pass, which is a
+// column if it reads any column; returns false on division by zero
+static bool compute(node_t *formula, int *value, int *column) {
+    if (reads_columns(formula)) {
+        *column = column_evaluate(formula);
+        return true;
+    }
+    *column = -1;
+    return node_evaluate(formula, value);
+}
+
+/* --- Dependencies between variables */
+
+// Growable arrays of symbol indexes
+typedef struct symbol_list_t {
+    int    *symbols;
+    size_t  n, max;
+} symbol_list_t;
+
+static void list_add(symbol_list_t *list, int symbol) {
+    if (list->n == list->max) {
+        list->max = list->max ? 2*list->max : 16;
+        list->symbols = check_alloc(realloc(list->symbols, list->max*sizeof(int)));
+    }
+    list->symbols[list->n++] = symbol;
+}
+
+// Replaces the reads of variable symbol in formula by its current value, so
+// that x = x + 1 increments x instead of defining it in terms of itself
+static node_t *bind_self(node_t *formula, int symbol) {
+    if (formula->operation == IDENTIFIER) {
+        if (formula->value != symbol) {
+            return formula;
+        }
+        return symbols[symbol].column < 0 ? node_number(symbols[symbol].value)
+                                          : node_column(symbols[symbol].column);
+    }
+    if (formula->operation == NUMBER || formula->operation == COLUMN) {
+        return formula;
+    }
+    node_t *operands[3] = {NULL, NULL, NULL};
+    for (int i=0; i<3 && formula->operands[i] != NULL; i++) {
+        operands[i] = bind_self(formula->operands[i], symbol);
+    }
+    return node_operation(formula->operation, operands[0], operands[1], operands[2]);
+}
+
+static void collect_references_(node_t *node, symbol_list_t *references) {
+    if (node->visited == visit_mark) {
+        return;
+    }
+    node->visited = visit_mark;
+    if (node->operation == IDENTIFIER && symbols[node->value].referenced != visit_mark) {
+        symbols[node->value].referenced = visit_mark;
+        list_add(references, node->value);
+    }
+    for (int i=0; i<3 && node->operands[i] != NULL; i++) {
+        collect_references_(node->operands[i], references);
+    }
+}
+
+// Collects the variables read by formula, without repetitions
+static void collect_references(node_t *formula, symbol_list_t *references) {
+    visit_mark++;
+    references->n = 0;
+    collect_references_(formula, references);
+}
+
+// Collects symbol and the variables that depend on it, directly or not, in an
+// order where every variable comes after all the variables it depends on;
+// the collected variables are left marked with visit_mark
+static void collect_dependents(int symbol, symbol_list_t *order) {
+    static symbol_list_t stack, next_dependent;
+    visit_mark++;
+    order->n = 0;
+    stack.n = next_dependent.n = 0;
+    symbols[symbol].visited = visit_mark;
+    list_add(&stack, symbol);
+    list_add(&next_dependent, 0);
+    // Depth-first search, collecting each variable after its dependents
+    while (stack.n > 0) {
+        symbol_t *top = &symbols[stack.symbols[stack.n-1]];
+        int *next = &next_dependent.symbols[next_dependent.n-1];
+        if (*next < top->dependents_n) {
+            int dependent = top->dependents[(*next)++];
+            if (symbols[dependent].visited != visit_mark) {
+                symbols[dependent].visited = visit_mark;
+                list_add(&stack, dependent);
+                list_add(&next_dependent, 0);
+            }
+        }
+        else {
+            list_add(order, stack.symbols[--stack.n]);
+            next_dependent.n--;
+        }
+    }
+    for (size_t i=0; i<order->n/2; i++) {
+        int swap = order->symbols[i];
+        order->symbols[i] = order->symbols[order->n-1-i];
+        order->symbols[order->n-1-i] = swap;
+    }
+}
+
+static void dependent_remove(int symbol, int dependent) {
+    symbol_t *s = &symbols[symbol];
+    for (size_t i=0; i<s->dependents_n; i++) {
+        if (s->dependents[i] == dependent) {
+            s->dependents[i] = s->dependents[--s->dependents_n];
+            return;
+        }
+    }
+}
+
+static void dependent_add(int symbol, int dependent) {
+    symbol_t *s = &symbols[symbol];
+    if (s->dependents_n == s->dependents_max) {
+        s->dependents_max = s->dependents_max ? 2*s->dependents_max : 4;
+        s->dependents = check_alloc(realloc(s->dependents, s->dependents_max*sizeof(int)));
+    }
+    s->dependents[s->dependents_n++] = dependent;
+}
+
+/* --- Assignments */
+
+void set_symbol(char *symbol_name, node_t *formula) {
+    static symbol_list_t order, references, old_values, old_columns;
+    int symbol = -1;
+    if (symbol_table_size > 0) {
+        symbol = symbol_table[symbol_slot(symbol_name)];
+    }
+
+    if (symbol < 0) {
+        // A new variable has no dependents yet
+        int value, column;
+        evaluation_pass++;
+        if (!compute(formula, &value, &column)) {
+            free(symbol_name);
+            return;
+        }
+        symbol = symbol_new(symbol_name);
+        symbols[symbol].value = value;
+        symbols[symbol].column = column;
+    }
+    else {
+        free(symbol_name);
+        formula = bind_self(formula, symbol);
+        collect_dependents(symbol, &order);
+        // Any variable read by the formula that depends on this one closes a cycle
+        unsigned dependents_mark = visit_mark;
+        collect_references(formula, &references);
+        for (size_t i=0; i<references.n; i++) {
+            if (symbols[references.symbols[i]].visited == dependents_mark) {
+                fprintf(stderr, "circular definition: %s\n", symbols[symbol].name);
+                return;
+            }
+        }
+
+        // Recomputes the variable and its dependents in a single pass, in which
+        // shared subexpressions are evaluated only once; if any of them divides
+        // by zero, the previous values are restored
+        old_values.n = old_columns.n = 0;
+        evaluation_pass++;
+        node_t *old_formula = symbols[symbol].formula;
+        symbols[symbol].formula = formula;
+        for (size_t i=0; i<order.n; i++) {
+            symbol_t *s = &symbols[order.symbols[i]];
+            list_add(&old_values, s->value);
+            list_add(&old_columns, s->column);
+            if (!compute(s->formula, &s->value, &s->column)) {
+                for (size_t j=0; j<=i; j++) {
+                    symbol_t *restored = &symbols[order.symbols[j]];
+                    if (restored->column != old_columns.symbols[j]) {
+                        column_release(restored->column);
+                    }
+                    restored->value = old_values.symbols[j];
+                    restored->column = old_columns.symbols[j];
+                }
+                symbols[symbol].formula = old_formula;
+                return;
+            }
+        }
+        for (size_t i=0; i<order.n; i++) {
+            if (symbols[order.symbols[i]].column != old_columns.symbols[i]) {
+                column_release(old_columns.symbols[i]);
+            }
+        }
+        for (size_t i=0; i<symbols[symbol].references_n; i++) {
+            dependent_remove(symbols[symbol].references[i], symbol);
+        }
+    }
+
+    symbol_t *s = &symbols[symbol];
+    s->formula = formula;
+    collect_references(formula, &references);
+    s->references = check_alloc(realloc(s->references, (references.n+1)*sizeof(int)));
+    memcpy(s->references, references.symbols, references.n*sizeof(int));
+    s->references_n = references.n;
+    for (size_t i=0; i<references.n; i++) {
+        dependent_add(references.symbols[i], symbol);
+    }
+}
+
+/* --- Output */
+
+void print_formula(node_t *formula) {
+    int value, column;
+    evaluation_pass++;
+    if (!compute(formula, &value, &column)) {
+        return;
+    }
+    if (column < 0) {
+        printf("%d\n", value);
+        return;
+    }
+    // Invalid rows are left empty, so the output stays aligned with the input
+    size_t invalid_rows = 0;
+    for (size_t row=0; row<rows_n; row++) {
+        if (columns[column].invalid[row]) {
+            invalid_rows++;
+            putchar('\n');
+        }
+        else {
+            printf("%d\n", columns[column].values[row]);
+        }
+    }
+    if (invalid_rows > 0) {
+        fprintf(stderr, "division by zero in %zu rows!\n", invalid_rows);
+    }
+    column_release(column);
+}
+
+void print_symbols(void) {
+    for (size_t index=0; index<symbol_table_size; index++) {
+        if (symbol_table[index] >= 0) {
+            symbol_t *s = &symbols[symbol_table[index]];
+            if (s->column < 0) {
+                printf("%s = %d\n", s->name, s->value);
+            }
+            else {
+                printf("%s = column of %zu rows\n", s->name, rows_n);
+            }
+        }
+    }
+}
+
+/* --- Column files */
+
+static void columns_error(const char *path, size_t line, const char *message) {
+    fprintf(stderr, "%s:%zu: %s\n", path, line, message);
+    exit(EXIT_FAILURE);
+}
+
+// Splits line in fields separated by commas, with surrounding spaces removed
+static size_t split_fields(char *line, char ***fields, size_t *fields_max) {
+    size_t n = 0;
+    char *field = line;
+    for (;;) {
+        char *end = field + strcspn(field, ",\n\r");
+        char separator = *end;
+        *end = '\0';
+        while (isspace((unsigned char) *field)) {
+            field++;
+        }
+        for (char *last=end-1; last>=field && isspace((unsigned char) *last); last--) {
+            *last = '\0';
+        }
+        if (n == *fields_max) {
+            *fields_max = *fields_max ? 2**fields_max : 16;
+            *fields = check_alloc(realloc(*fields, *fields_max*sizeof(char *)));
+        }
+        (*fields)[n++] = field;
+        if (separator != ',') {
+            return n;
+        }
+        field = end+1;
+    }
+}
+
+void columns_load(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "error opening columns file: %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    char *line = NULL;
+    size_t line_max = 0, line_number = 1;
+    char **fields = NULL;
+    size_t fields_max = 0;
+    if (getline(&line, &line_max, file) < 0) {
+        columns_error(path, line_number, "missing column names");
+    }
+
+    size_t columns_file_n = split_fields(line, &fields, &fields_max);
+    int *symbol = check_alloc(malloc(columns_file_n*sizeof(int)));
+    for (size_t i=0; i<columns_file_n; i++) {
+        char *name = fields[i];
+        bool valid = isalpha((unsigned char) name[0]) || name[0] == '_';
+        for (char *c=name; *c!='\0'; c++) {
+            valid = valid && (isalnum((unsigned char) *c) || *c == '_');
+        }
+        if (!valid) {
+            columns_error(path, line_number, "invalid column name");
+        }
+        if (symbol_table_size > 0 && symbol_table[symbol_slot(name)] >= 0) {
+            columns_error(path, line_number, "repeated column name");
+        }
+        symbol[i] = symbol_new(check_alloc(strdup(name)));
+    }
+
+    // Values are read in growable arrays, and only then moved to the columns
+    int **values = check_alloc(calloc(columns_file_n, sizeof(int *)));
+    size_t rows_max = 0;
+    while (getline(&line, &line_max, file) >= 0) {
+        line_number++;
+        if (line[strspn(line, " \t\r\n")] == '\0') {
+            continue;
+        }
+        if (split_fields(line, &fields, &fields_max) != columns_file_n) {
+            columns_error(path, line_number, "wrong number of values");
+        }
+        if (rows_n == rows_max) {
+            rows_max = rows_max ? 2*rows_max : 1024;
+            for (size_t i=0; i<columns_file_n; i++) {
+                values[i] = check_alloc(realloc(values[i], rows_max*sizeof(int)));
+            }
+        }
+        for (size_t i=0; i<columns_file_n; i++) {
+            char *notnumber_ptr;
+            long value = strtol(fields[i], &notnumber_ptr, 10);
+            if (fields[i][0] == '\0' || *notnumber_ptr != '\0' || value < INT_MIN || value > INT_MAX) {
+                columns_error(path, line_number, "invalid value");
+            }
+            values[i][rows_n] = value;
+        }
+        rows_n++;
+    }
+    fclose(file);
+
+    for (size_t i=0; i<columns_file_n; i++) {
+        int column = column_new();
+        memcpy(columns[column].values, values[i], rows_n*sizeof(int));
+        symbols[symbol[i]].column = column;
+        symbols[symbol[i]].formula = node_column(column);
+        free(values[i]);
+    }
+    free(values);
+    free(symbol);
+    free(fields);
+    free(line);
+}
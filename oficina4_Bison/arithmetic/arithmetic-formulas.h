@@ -0,0 +1,53 @@
+#ifndef ARITHMETIC_FORMULAS_H
+#define ARITHMETIC_FORMULAS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* --- Expression nodes
+
+   Nodes are interned: building a node equal to an existing one returns the
+   existing node, so the formulas of all variables form a single DAG where
+   common subexpressions are shared, and evaluated once per evaluation pass.
+   Nodes are never freed. */
+
+typedef struct node_t node_t;
+
+// Creates (or finds) a constant node
+node_t *node_number(int value);
+// Creates (or finds) a node that reads the variable with the given symbol index
+node_t *node_symbol(int symbol);
+// Creates (or finds) a node for an operator, with 1 to 3 operands (the others NULL);
+// operations with only constant operands are folded into a constant node
+node_t *node_operation(int operation, node_t *op1, node_t *op2, node_t *op3);
+
+// Evaluates formula with the current values of the variables and shows its
+// value, or one value per row if it reads any column
+void print_formula(node_t *formula);
+
+/* --- Symbol table: variables are defined by formulas, and are recomputed
+       whenever a variable their formula depends on is assigned */
+
+// Gets the index of symbol symbol_name, shows a message and returns false if undefined
+bool get_symbol(const char *symbol_name, int *symbol);
+// Gets the current value of the variable with the given symbol index
+int symbol_value(int symbol);
+// Assigns formula to symbol symbol_name (which is taken by the symbol table) and
+// recomputes the variables that depend on it; an assignment that would divide by
+// zero or create a circular dependency shows a message and has no effect
+void set_symbol(char *symbol_name, node_t *formula);
+// Shows all variables and their values
+void print_symbols(void);
+
+/* --- Columns: variables bound to columns of integers read from a CSV file,
+       with the names in the first line and the values in the following ones.
+
+   A formula that reads a column is a column too. It is compiled once into a
+   sequence of operations, each applied to blocks of rows with branch-free
+   loops the compiler can vectorize. A division by zero does not stop the
+   evaluation, it only marks the rows where it happens as invalid. */
+
+// Binds a variable to each column of the file, exits on errors
+void columns_load(const char *path);
+
+#endif
@@ -1,3 +1,7 @@
+%code requires {
+  #include "arithmetic-formulas.h"
+}
+
 %{
   #include <stdbool.h>
   #include <stdio.h>
@@ -6,16 +10,6 @@
 
   int yylex(void);
   void yyerror(const char *s);
-
-  bool check_zero(int value);
-
-  // Symbol table
-  #define MAX_SYMBOLS 1024
-  const char *symbol_names[MAX_SYMBOLS];
-  int symbol_values[MAX_SYMBOLS];
-  bool get_symbol(const char *symbol_name, int *symbol_value);
-  void set_symbol(const char *symbol_name, int symbol_value);
-  void print_symbols(void);
 %}
 
 %define api.value.type union
@@ -27,9 +21,12 @@
 %destructor { free($$); } <char *>;
 
 %token <int> NUMBER
-%nterm <int> exp
 %destructor { } <int>;
 
+// Formulas are kept (and shared) by the symbol table, and never freed
+%nterm <node_t *> exp
+%destructor { } <node_t *>;
+
 %destructor { } <>;
 
 %nonassoc ':'
@@ -44,13 +41,14 @@
 
 %%
 
+// Left recursive, so long inputs do not grow the parser stack
 statements:
-      statement statements
+      statements statement
     | statement
     ;
 
 statement:
-      exp eol                { printf("%d\n", $exp);          }
+      exp eol                { print_formula($exp);           }
     | IDENTIFIER '=' exp eol { set_symbol($IDENTIFIER, $exp); }
     | DIR eol                { print_symbols();               }
     | EXIT eol               { exit(EXIT_SUCCESS);            }
@@ -61,110 +59,62 @@ statement:
 eol: '\n' | ';';
 
 exp:
-      exp '+' exp            { $$ = $1 + $3; }
-    | exp '-' exp            { $$ = $1 - $3; }
-    | exp '*' exp            { $$ = $1 * $3; }
-    | '-' exp  %prec UMINUS  { $$ = -$2;     }
+      exp '+' exp            { $$ = node_operation('+', $1, $3, NULL);       }
+    | exp '-' exp            { $$ = node_operation('-', $1, $3, NULL);       }
+    | exp '*' exp            { $$ = node_operation('*', $1, $3, NULL);       }
+    | '-' exp  %prec UMINUS  { $$ = node_operation(UMINUS, $2, NULL, NULL);  }
     ;
 
 exp:
-      exp '/' exp { if (check_zero($3)) { YYERROR; } else { $$ = $1 / $3; } }
-    | exp '%' exp { if (check_zero($3)) { YYERROR; } else { $$ = $1 % $3; } }
+      exp '/' exp { $$ = node_operation('/', $1, $3, NULL); }
+    | exp '%' exp { $$ = node_operation('%', $1, $3, NULL); }
     ;
 
 exp:
-      exp '|' exp { $$ = $1 | $3; }
-    | exp '^' exp { $$ = $1 ^ $3; }
-    | exp '&' exp { $$ = $1 & $3; }
-    | '~' exp     { $$ = ~$2;     }
+      exp '|' exp { $$ = node_operation('|', $1, $3, NULL); }
+    | exp '^' exp { $$ = node_operation('^', $1, $3, NULL); }
+    | exp '&' exp { $$ = node_operation('&', $1, $3, NULL); }
+    | '~' exp     { $$ = node_operation('~', $2, NULL, NULL); }
     ;
 
 exp:
-      exp EQ exp { $$ = $1 == $3 ? -1 : 0; }
-    | exp NE exp { $$ = $1 != $3 ? -1 : 0; }
-    | exp GT exp { $$ = $1 >  $3 ? -1 : 0; }
-    | exp GE exp { $$ = $1 >= $3 ? -1 : 0; }
-    | exp LT exp { $$ = $1 <  $3 ? -1 : 0; }
-    | exp LE exp { $$ = $1 <= $3 ? -1 : 0; }
+      exp EQ exp { $$ = node_operation(EQ, $1, $3, NULL); }
+    | exp NE exp { $$ = node_operation(NE, $1, $3, NULL); }
+    | exp GT exp { $$ = node_operation(GT, $1, $3, NULL); }
+    | exp GE exp { $$ = node_operation(GE, $1, $3, NULL); }
+    | exp LT exp { $$ = node_operation(LT, $1, $3, NULL); }
+    | exp LE exp { $$ = node_operation(LE, $1, $3, NULL); }
     ;
 
-exp: exp '?' exp ':' exp { $$ = $1 ? $3 : $5; }
+exp: exp '?' exp ':' exp { $$ = node_operation('?', $1, $3, $5); }
     ;
 
-exp:  '(' exp ')'   { $$ = $2; }
-    | NUMBER        { $$ = $1; }
+exp:  '(' exp ')'   { $$ = $2;              }
+    | NUMBER        { $$ = node_number($1); }
     ;
 
-exp: IDENTIFIER { int symbol_value = 0;
-                  if (!get_symbol($1, &symbol_value)) YYERROR;
-                  $$ = symbol_value;
+exp: IDENTIFIER { int symbol;
+                  bool defined = get_symbol($1, &symbol);
+                  free($1);
+                  if (!defined) YYERROR;
+                  $$ = node_symbol(symbol);
                 }
     ;
 
 %%
 
-bool check_zero(int value) {
-    if (value == 0) {
-        fprintf(stderr, "division by zero!\n");
-        return true;
-    }
-    return false;
-}
-
-size_t symbol_hash(const char *symbol_name) {
-    size_t hash = 0x18462937; // random value
-    for (int i=0; symbol_name[i]!='\0'; i++) {
-        hash ^= symbol_name[i];
-        hash = (hash << 5) | (hash >> (sizeof(hash)*8-5)); // rol(hash, 5)
-    }
-    return hash;
-}
-
-bool get_symbol(const char *symbol_name, int *symbol_value) {
-    size_t index = symbol_hash(symbol_name) % MAX_SYMBOLS;
-    for (int i=0; i<MAX_SYMBOLS && symbol_names[index] != NULL; i++) {
-        if (strcmp(symbol_names[index], symbol_name) == 0) {
-            *symbol_value = symbol_values[index];
-            return true;
-        }
-        index = (index+1) % MAX_SYMBOLS;
-    }
-    fprintf(stderr, "undefined variable: %s\n", symbol_name);
-    return false;
+void yyerror(const char *s) {
+    fprintf(stderr, "%s\n", s);
 }
 
-void set_symbol(const char *symbol_name, int symbol_value) {
-    size_t index = symbol_hash(symbol_name) % MAX_SYMBOLS;
-    for (int i=0; i<MAX_SYMBOLS && symbol_names[index] != NULL; i++) {
-        if (strcmp(symbol_names[index], symbol_name) == 0) {
-            symbol_values[index] = symbol_value;
-            return;
-        }
-        index = (index+1) % MAX_SYMBOLS;
-    }
-    if (symbol_names[index] == NULL) {
-        symbol_names[index] = symbol_name;
-        symbol_values[index] = symbol_value;
+int main(int argc, char *argv[]) {
+    if (argc == 3 && strcmp(argv[1], "--columns") == 0) {
+        columns_load(argv[2]);
     }
-    else {
-        fprintf(stderr, "too many variables!\n");
+    else if (argc != 1) {
+        fprintf(stderr, "usage: %s [--columns <FILE.csv>]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
-}
-
-void print_symbols(void) {
-    for (size_t index=0; index<MAX_SYMBOLS; index++) {
-        if (symbol_names[index] != NULL) {
-            printf("%s = %d\n", symbol_names[index], symbol_values[index]);
-        }
-    }
-}
-
-void yyerror(const char *s) {
-    fprintf(stderr, "%s\n", s);
-}
-
-int main(void) {
     yyparse();
     return EXIT_SUCCESS;
 }
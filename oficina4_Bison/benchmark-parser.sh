@@ -0,0 +1,64 @@
+#!/bin/bash
+# Measures the parse throughput of lua-parser on a large generated script,
+# comparing the LALR(1) parser with the same grammar built with the GLR skeleton
+#
+# usage: ./benchmark-parser.sh [<BLOCKS>]
+#        each block of the generated script has 12 lines (default 20000 blocks)
+
+blocks=${1:-20000}
+
+bison lua-parser.y && bison -S glr.c -o lua-parser-glr.tab.c lua-parser.y
+if [ "$?" != "0" ]; then
+    echo Error creating parsers!
+    exit 1
+fi
+flex lua-lexer.l
+if [ "$?" != "0" ]; then
+    echo Error creating scanner!
+    exit 1
+fi
+sources="lua-lexer.c lua-semantics.c lua-token-cache.c"
+gcc -O2 -o lua-parser-lalr lua-parser.tab.c $sources -Wall -lm -std=gnu99 &&
+gcc -O2 -o lua-parser-glr lua-parser-glr.tab.c $sources -Wall -lm -std=gnu99
+if [ "$?" != "0" ]; then
+    echo Error creating executables!
+    exit 1
+fi
+
+script=benchmark.lua
+awk -v blocks="$blocks" 'BEGIN {
+    print "x = 1; y = 2; z = 0.5"
+    for (i=0; i<blocks; i++) {
+        print "x = (x + " i ") * 2 - y / 3 % 7 -- update x"
+        print "local s, t = \"item \" .. x, [[long"
+        print "string]]"
+        print "if x > y and not (z == 0) then"
+        print "    y = y + 1"
+        print "elseif x == y then"
+        print "    y = 0"
+        print "else"
+        print "    z = -z ^ 2"
+        print "end"
+        print "print(x, y, #s, z >= 1 or z < -1)"
+        print "w = { " i ", \"" i "\"; n = " i " }"
+    }
+}' > "$script"
+echo "Script with $(wc -l < "$script") lines, $(wc -c < "$script") bytes"
+
+# The runs without the cache measure the whole program, with the scanner
+# generated by flex; the token cache is then written by a first run, so the
+# runs with it measure the parser (and semantic actions) alone
+TIMEFORMAT=%R
+for parser in lua-parser-lalr lua-parser-glr; do
+    rm -f "$script.luacache"
+    for run in 1 2 3; do
+        echo -n "$parser run $run (scanner and parser): "
+        { time ./$parser "$script" > /dev/null 2>&1 ; } 2>&1
+    done
+    ./$parser --cache "$script" > /dev/null 2>&1
+    for run in 1 2 3; do
+        echo -n "$parser run $run (parser only): "
+        { time ./$parser --cache "$script" > /dev/null 2>&1 ; } 2>&1
+    done
+done
+rm -f "$script" "$script.luacache" lua-parser-glr.tab.c lua-parser-glr.tab.h
@@ -10,9 +10,7 @@
 
 /* --------- Declarations for generated parser */
 
-%glr-parser
-%expect 1
-%expect-rr 1
+%expect 0
 %file-prefix "lua-parser"
 %defines
 
@@ -27,6 +25,12 @@
 
 /* --- Operator precedences and associativities */
 
+/* A prefix expression (or function call) followed by `(´ is always continued
+   as a function call, instead of ending a statement before another one
+   starting with `(´ */
+%precedence PREFIX_END
+%precedence OPEN_PAR
+
 %left <keyword> OR
 %left <keyword> AND
 %left <keyword> LT GT LE GE DIFF EQUAL
@@ -51,8 +55,8 @@
 
 /* --- Types of nonterminals */
 
-%type <name>   var
-%type <value>  exp exp_binary exp_unary exp_prefix
+%type <name>   var stat_var
+%type <value>  exp exp_binary exp_unary exp_prefix stat_prefix
 %type <list>   var_list exp_list name_list
 
 %% /* --------- Declarations for generated parser */
@@ -138,7 +142,7 @@ else_clause:
     |
     ;
 
-stat_call: function_call;
+stat_call: call_statement %prec PREFIX_END;
 
 stat_disabled_control:
     stat_while
@@ -211,8 +215,8 @@ var_list:
       var_list COMMA var { list_append(&variable_list, $var);
                            $$ = &variable_list;
                          }
-    | var                { list_reset(&variable_list);
-                           list_append(&variable_list, $var);
+    | stat_var           { list_reset(&variable_list);
+                           list_append(&variable_list, $stat_var);
                            $$ = &variable_list;
                          }
     ;
@@ -274,7 +278,7 @@ exp:
     | ELLIPSIS             { $$ = !cond_enabled() ? NULL : make_value(DTYPE_INVALID,       0,    NULL); }
     | exp_binary           { $$ = !cond_enabled() ? NULL : $exp_binary; }
     | exp_unary            { $$ = !cond_enabled() ? NULL : $exp_unary;  }
-    | exp_prefix %expect 1 { $$ = !cond_enabled() ? NULL : $exp_prefix; }
+    | exp_prefix %prec PREFIX_END { $$ = !cond_enabled() ? NULL : $exp_prefix; }
     | exp_function         { $$ = !cond_enabled() ? NULL : make_value(DTYPE_INVALID, 0, NULL); }
     | table_constructor    { $$ = !cond_enabled() ? NULL : make_value(DTYPE_INVALID, 0, NULL); }
     ;
@@ -317,22 +321,9 @@ exp_unary:
 
 exp_prefix:
       OPEN_PAR exp CLOSE_PAR     { $$ = !cond_enabled() ? NULL : $exp; }
-    | function_call %expect-rr 1 { warn("function call");
+    | function_call              { warn("function call");
                                    $$ = !cond_enabled() ? NULL : make_value(DTYPE_INVALID,  0, NULL); }
-    | var                       { if (cond_enabled()) {
-                                    if ($var != NULL) {
-                                        lua_value_t *variable_value;
-                                        get_symbol($var, &variable_value);
-                                        $$ = variable_value;
-                                    }
-                                    else {
-                                        $$ = make_value(DTYPE_INVALID, 0, NULL);
-                                    }
-                                }
-                                else {
-                                    $$ = NULL;
-                                }
-                                }
+    | var                        { get_variable($var, &$$); }
     ;
 
 /* functioncall ::=  prefixexp args | prefixexp `:´ Name args
@@ -365,6 +356,39 @@ arg_list:
     | OPEN_PAR CLOSE_PAR
     ;
 
+/* ---  Prefix expressions starting statements */
+
+/* These repeat var, exp_prefix and function_call, except that a function call
+   is not a prefix expression: the rules that continue a call take the call
+   itself, so at its end the parser chooses between ending the statement and
+   continuing the call by shifting (or not) the next token, instead of by
+   choosing between two reductions. Inside expressions the original rules are
+   kept, so that a function call there is reduced as soon as it ends.
+*/
+
+stat_var:
+      NAME                               { $$ = $NAME; }
+    | stat_prefix OPEN_BRA exp CLOSE_BRA { $$ = NULL; warn("var[item] access"); }
+    | stat_prefix DOT NAME               { $$ = NULL; warn("var.field access"); }
+    | call_statement                     { warn("function call"); }
+      OPEN_BRA exp CLOSE_BRA             { $$ = NULL; warn("var[item] access"); }
+    | call_statement                     { warn("function call"); }
+      DOT NAME                           { $$ = NULL; warn("var.field access"); }
+    ;
+
+stat_prefix:
+      OPEN_PAR exp CLOSE_PAR { $$ = !cond_enabled() ? NULL : $exp; }
+    | stat_var               { get_variable($stat_var, &$$); }
+    ;
+
+call_statement:
+      stat_prefix arg_list
+    | stat_prefix COLON NAME arg_list
+    | call_statement arg_list            { warn("function call"); }
+    | call_statement                     { warn("function call"); }
+      COLON NAME arg_list
+    ;
+
 /* tableconstructor ::= `{´ [fieldlist] `}´
    fieldlist ::= field {fieldsep field} [fieldsep]
    field ::= `[´ exp `]´ `=´ exp | Name `=´ exp | exp
@@ -402,22 +426,71 @@ field_sep:
 #include <string.h>
 #include <unistd.h>
 
+static void usage(void) {
+    fprintf(stderr, "usage: lua-parser [<OPTIONS>] <source.lua>\n"
+                    "       lua-parser [<OPTIONS>] --\n\n"
+                    "       use the second syntax to read source from standard input.\n\n"
+                    "options:\n"
+                    "       --cache           keeps the tokens of the source in <source.lua>.luacache,\n"
+                    "                         so later runs on the same (unchanged) source skip the scanner\n"
+                    "       --max-errors <N>  stops after N errors\n"
+                    "       --max-repeats <N> shows each error or warning message at most N times,\n"
+                    "                         and how many more there were at the end\n"
+                    "       --json            writes errors and warnings as JSON objects, one per line\n"
+                    "       --dedup           omits errors and warnings already shown for the same line\n");
+    exit(EXIT_FAILURE);
+}
+
 int main (int argc, char const* argv[]) {
-    if (argc <= 1) {
-        fprintf(stderr, "usage: lua-parser <source.lua>\n"
-                        "       lua-parser --\n\n"
-                        "       use the second syntax to read source from standard input.\n");
-        exit(EXIT_FAILURE);
+    bool use_cache = false;
+    diagnostics_options_t diagnostics_options = { .max_errors = 0, .max_repeats = 0, .json = false, .dedup = false };
+    int arg_i = 1;
+    for (; arg_i < argc && strncmp(argv[arg_i], "--", 2) == 0 && argv[arg_i][2] != '\0'; arg_i++) {
+        if (strcmp(argv[arg_i], "--cache") == 0) {
+            use_cache = true;
+        }
+        else if (strcmp(argv[arg_i], "--max-errors") == 0 && arg_i+1 < argc) {
+            char *notnumber_ptr;
+            long max_errors = strtol(argv[++arg_i], &notnumber_ptr, 10);
+            if (*notnumber_ptr != '\0' || max_errors <= 0) {
+                usage();
+            }
+            diagnostics_options.max_errors = max_errors;
+        }
+        else if (strcmp(argv[arg_i], "--max-repeats") == 0 && arg_i+1 < argc) {
+            char *notnumber_ptr;
+            long max_repeats = strtol(argv[++arg_i], &notnumber_ptr, 10);
+            if (*notnumber_ptr != '\0' || max_repeats <= 0) {
+                usage();
+            }
+            diagnostics_options.max_repeats = max_repeats;
+        }
+        else if (strcmp(argv[arg_i], "--json") == 0) {
+            diagnostics_options.json = true;
+        }
+        else if (strcmp(argv[arg_i], "--dedup") == 0) {
+            diagnostics_options.dedup = true;
+        }
+        else {
+            usage();
+        }
+    }
+    if (arg_i >= argc) {
+        usage();
     }
+    const char *source_path = argv[arg_i];
 
-    if (strcmp(argv[1], "--") == 0) {
+    if (strcmp(source_path, "--") == 0) {
+        if (use_cache) {
+            usage();
+        }
         yyin = stdin;
     }
     else {
-        yyin = fopen(argv[1], "r");
+        yyin = fopen(source_path, "r");
         if (yyin == NULL) {
             interactive = true;
-            fatal("error opening source file: %s", argv[1])
+            fatal("error opening source file: %s", source_path)
         }
     }
 
@@ -430,10 +503,14 @@ int main (int argc, char const* argv[]) {
     list_init(Max_lua_list_size, &expression_list);
 
     interactive = isatty(fileno(yyin));
+    diagnostics_init(diagnostics_options);
     scanner_set_interactive(interactive);
     yynewline();
 
+    if (use_cache && !interactive) {
+        token_cache_open(source_path);
+    }
+
     yyparse();
     return EXIT_SUCCESS;
 }
-
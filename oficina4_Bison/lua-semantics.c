@@ -1,10 +1,12 @@
 #include <assert.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <unistd.h>
 
 #include "lua-semantics.h"
 #include "lua-parser.tab.h"
@@ -45,6 +47,7 @@ void string_append(const char *content) {
     size_t content_size = strlen(content);
     if (string_size+content_size > Max_string_size) {
         yyerror("maximum string size exceeded");
+        return;
     }
     memcpy(string_buffer+string_size, content, content_size+1);
     string_size += content_size;
@@ -123,6 +126,18 @@ bool get_symbol_(const char *symbol_name, lua_value_t **symbol_value) {
     return false;
 }
 
+bool get_variable_(const char *var_name, lua_value_t **var_value) {
+    if (!cond_enabled()) {
+        *var_value = NULL;
+        return true;
+    }
+    if (var_name == NULL) {
+        *var_value = make_value(DTYPE_INVALID, 0, NULL);
+        return true;
+    }
+    return get_symbol_(var_name, var_value);
+}
+
 void set_symbol(const char *symbol_name, lua_value_t *symbol_value) {
     size_t index = symbol_hash(symbol_name) % Symbol_table_size;
     for (int i=0; i<Symbol_table_size && symbol_names[index] != NULL; i++) {
@@ -513,34 +528,223 @@ void yynewline(void) {
     }
 }
 
-static const size_t Max_message_size = 1024;
+#define Max_message_size 1024
 
-// Prints message to stderr, adding line number if session is not interactive;
-// a newline is always appended
-static void print_message(const char *message) {
-    if (interactive) {
-        fprintf(stderr, "%s\n", message);
-    }
-    else {
-        fprintf(stderr, "%s (line %d)\n", message, line_number);
-    }
+static void vdiagnostic(diagnostic_severity_t severity, const char *message, va_list arglist) {
+    char formatted_message[Max_message_size];
+    vsnprintf(formatted_message, Max_message_size, message, arglist);
+    diagnostic(severity, formatted_message);
 }
 
 void yyerror(const char *message, ...) {
-    char partial_message[Max_message_size];
-    char formatted_message[Max_message_size];
     va_list arglist;
     va_start(arglist, message);
-    vsnprintf(partial_message, Max_message_size, message, arglist);
-    snprintf(formatted_message, Max_message_size, "error: %s", partial_message);
-    print_message(formatted_message);
+    vdiagnostic(DIAGNOSTIC_ERROR, message, arglist);
+    va_end(arglist);
+}
+
+void yyfatal(const char *message, ...) {
+    va_list arglist;
+    va_start(arglist, message);
+    vdiagnostic(DIAGNOSTIC_FATAL, message, arglist);
     va_end(arglist);
 }
 
 void warn(const char *feature) {
-    const char *uninmplemented_message = "not implemented: %s -- code will be parsed but will have no effect";
-    char formatted_message[Max_message_size];
-    snprintf(formatted_message, Max_message_size, uninmplemented_message, feature);
-    print_message(formatted_message);
+    diagnostic(DIAGNOSTIC_WARNING, feature);
 }
 
+/* --- Diagnostics: sink for the errors and warnings */
+
+static const size_t Diagnostics_buffer_size = 64*1024;
+
+// Text around the message of each severity
+static const char *Text_prefixes[] = {
+    [DIAGNOSTIC_ERROR]   = "error: ",
+    [DIAGNOSTIC_WARNING] = "not implemented: ",
+    [DIAGNOSTIC_FATAL]   = "error: ",
+};
+static const char *Text_suffixes[] = {
+    [DIAGNOSTIC_ERROR]   = "",
+    [DIAGNOSTIC_WARNING] = " -- code will be parsed but will have no effect",
+    [DIAGNOSTIC_FATAL]   = "",
+};
+static const char *Json_severities[] = {
+    [DIAGNOSTIC_ERROR]   = "error",
+    [DIAGNOSTIC_WARNING] = "warning",
+    [DIAGNOSTIC_FATAL]   = "fatal",
+};
+static const char *Json_prefixes[] = {
+    [DIAGNOSTIC_ERROR]   = "",
+    [DIAGNOSTIC_WARNING] = "not implemented: ",
+    [DIAGNOSTIC_FATAL]   = "",
+};
+
+void (*diagnostic_capture)(diagnostic_severity_t severity, const char *message, int line) = NULL;
+
+static diagnostics_options_t diagnostics_options;
+static size_t errors_n = 0;
+
+// Distinct diagnostics seen, in order of first occurrence: with their line for
+// the deduplication, and with Any_line for the limit of repeats of a message
+typedef struct diagnostic_entry_t {
+    uint64_t              hash;
+    diagnostic_severity_t severity;
+    int                   line;
+    size_t                count;
+    char                 *message;
+} diagnostic_entry_t;
+
+static const int Any_line = -1;
+
+static diagnostic_entry_t *entries = NULL;
+static size_t entries_n = 0, entries_max = 0;
+// Hash table of indexes in entries plus 1 (0 is a free slot), with linear probing
+static size_t *entry_slots = NULL;
+static size_t entry_slots_n = 0;  // power of 2
+
+// FNV-1a of the message, the severity and the line
+static uint64_t entry_hash(diagnostic_severity_t severity, int line, const char *message) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (const unsigned char *c = (const unsigned char *) message; *c != '\0'; c++) {
+        hash = (hash ^ *c) * 0x100000001b3;
+    }
+    hash = (hash ^ (uint64_t) severity) * 0x100000001b3;
+    return (hash ^ (uint32_t) line) * 0x100000001b3;
+}
+
+static void entry_slots_grow(void) {
+    free(entry_slots);
+    entry_slots_n = entry_slots_n == 0 ? 256 : 2*entry_slots_n;
+    entry_slots = check_alloc(calloc(entry_slots_n, sizeof(size_t)));
+    for (size_t i=0; i<entries_n; i++) {
+        size_t slot = entries[i].hash & (entry_slots_n-1);
+        while (entry_slots[slot] != 0) {
+            slot = (slot+1) & (entry_slots_n-1);
+        }
+        entry_slots[slot] = i+1;
+    }
+}
+
+// Finds the entry of a diagnostic, adding it with count 0 if it is new
+static diagnostic_entry_t *entry_find(diagnostic_severity_t severity, int line, const char *message) {
+    if (2*(entries_n+1) > entry_slots_n) {
+        entry_slots_grow();
+    }
+    const uint64_t hash = entry_hash(severity, line, message);
+    size_t slot = hash & (entry_slots_n-1);
+    for (; entry_slots[slot] != 0; slot = (slot+1) & (entry_slots_n-1)) {
+        diagnostic_entry_t *entry = &entries[entry_slots[slot]-1];
+        if (entry->hash == hash && entry->severity == severity && entry->line == line
+                && strcmp(entry->message, message) == 0) {
+            return entry;
+        }
+    }
+
+    if (entries_n == entries_max) {
+        entries_max = entries_max == 0 ? 128 : 2*entries_max;
+        entries = check_alloc(realloc(entries, entries_max*sizeof(diagnostic_entry_t)));
+    }
+    diagnostic_entry_t *entry = &entries[entries_n++];
+    *entry = (diagnostic_entry_t) {
+        .hash     = hash,
+        .severity = severity,
+        .line     = line,
+        .count    = 0,
+        .message  = check_alloc(strdup(message)),
+    };
+    entry_slots[slot] = entries_n;
+    return entry;
+}
+
+static void write_suppressed(void);
+
+void diagnostics_init(diagnostics_options_t options) {
+    diagnostics_options = options;
+    if (!isatty(fileno(stderr))) {
+        setvbuf(stderr, NULL, _IOFBF, Diagnostics_buffer_size);
+    }
+    if (options.max_repeats > 0) {
+        // Also runs when the program stops on a fatal error or on too many errors
+        atexit(write_suppressed);
+    }
+}
+
+// Writes text inside a JSON string, escaping everything but printable ASCII
+static void write_json_characters(const char *text) {
+    for (const unsigned char *c = (const unsigned char *) text; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            putc('\\', stderr);
+            putc(*c, stderr);
+        }
+        else if (*c < 0x20 || *c >= 0x7F) {
+            fprintf(stderr, "\\u%04x", *c);
+        }
+        else {
+            putc(*c, stderr);
+        }
+    }
+}
+
+static void write_diagnostic(diagnostic_severity_t severity, const char *message) {
+    if (diagnostics_options.json) {
+        fprintf(stderr, "{\"severity\": \"%s\", \"line\": %d, \"message\": \"", Json_severities[severity], line_number);
+        write_json_characters(Json_prefixes[severity]);
+        write_json_characters(message);
+        fputs("\"}\n", stderr);
+    }
+    else if (interactive) {
+        fprintf(stderr, "%s%s%s\n", Text_prefixes[severity], message, Text_suffixes[severity]);
+    }
+    else {
+        fprintf(stderr, "%s%s%s (line %d)\n", Text_prefixes[severity], message, Text_suffixes[severity], line_number);
+    }
+}
+
+// Sums up the messages that went over the limit of repeats
+static void write_suppressed(void) {
+    for (size_t i=0; i<entries_n; i++) {
+        const diagnostic_entry_t *entry = &entries[i];
+        if (entry->line != Any_line || entry->count <= diagnostics_options.max_repeats) {
+            continue;
+        }
+        const size_t suppressed = entry->count - diagnostics_options.max_repeats;
+        if (diagnostics_options.json) {
+            fprintf(stderr, "{\"severity\": \"%s\", \"suppressed\": %zu, \"message\": \"", Json_severities[entry->severity], suppressed);
+            write_json_characters(Json_prefixes[entry->severity]);
+            write_json_characters(entry->message);
+            fputs("\"}\n", stderr);
+        }
+        else {
+            fprintf(stderr, "%s%s%s (%zu more suppressed)\n", Text_prefixes[entry->severity], entry->message, Text_suffixes[entry->severity], suppressed);
+        }
+    }
+}
+
+void diagnostic(diagnostic_severity_t severity, const char *message) {
+    if (severity == DIAGNOSTIC_FATAL) {
+        // Written even while capturing, as the program stops right after
+        write_diagnostic(severity, message);
+        return;
+    }
+    if (diagnostic_capture != NULL) {
+        diagnostic_capture(severity, message, line_number);
+        return;
+    }
+
+    if (diagnostics_options.dedup && entry_find(severity, line_number, message)->count++ > 0) {
+        return;
+    }
+    // Messages over the limit still count as errors for max_errors
+    if (diagnostics_options.max_repeats == 0
+            || entry_find(severity, Any_line, message)->count++ < diagnostics_options.max_repeats) {
+        write_diagnostic(severity, message);
+    }
+    if (severity == DIAGNOSTIC_ERROR) {
+        errors_n++;
+        if (errors_n == diagnostics_options.max_errors) {
+            write_diagnostic(DIAGNOSTIC_ERROR, "too many errors, stopping");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
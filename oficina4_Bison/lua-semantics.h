@@ -9,11 +9,30 @@
 
 extern char *yytext;
 extern FILE *yyin;
-int yylex(void);
+int scanner_lex(void);
 void scanner_set_interactive(bool interactive);
 void scanner_start_recovery(void);
 void scanner_end_recovery(void);
 
+extern size_t scanner_offset;          // source offset just after the last match
+extern bool   scanner_report_newlines; // returns NEWLINE also outside error recovery
+extern bool   scanner_context_entered; // set when the scanner enters a string or comment
+// Checks if the scanner is outside strings and comments
+bool scanner_in_code(void);
+// Checks if the scanner is between scanner_start_recovery and scanner_end_recovery
+bool scanner_in_recovery(void);
+// Restarts the scanner on the given text, in the initial state
+void scanner_restart(const char *text, size_t length);
+
+/* --- Token cache (lua-token-cache.c) */
+
+// Gets the next token for the parser, from the cache if one is open, otherwise
+// from the scanner
+int yylex(void);
+// Reads the tokens of source_path from its cache file (source_path.luacache),
+// regenerating the cache if it is missing or does not match the source
+void token_cache_open(const char *source_path);
+
 /* --- Ancillary functions */
 
 // If ptr is NULL aborts program with "not enough error" message, otherwise returns ptr
@@ -79,6 +98,10 @@ void list_append(list_t *list, const void *element);
 // triggers syntactic error if symbol is not found
 #define get_symbol(symbol_name, symbol_value) { if (!get_symbol_(symbol_name, symbol_value)) YYERROR; }
 bool get_symbol_(const char *symbol_name, lua_value_t **symbol_value);
+// Gets the value of variable var_name for an expression: NULL if execution is disabled, an invalid value
+// for variables that are not symbols (var_name is NULL); triggers syntactic error if symbol is not found
+#define get_variable(var_name, var_value) { if (!get_variable_(var_name, var_value)) YYERROR; }
+bool get_variable_(const char *var_name, lua_value_t **var_value);
 // Sets symbol symbol_name to, symbol_value
 void set_symbol(const char *symbol_name, lua_value_t *symbol_value);
 // Sets each symbol with name (of type char *) in the list symbol_names to value (of type lua_value_t *)
@@ -130,8 +153,34 @@ void yynewline(void);
 
 // Formats error messages, uses same parameters as printf
 void yyerror(const char *message, ...);
-#define fatal(...) { yyerror(__VA_ARGS__); exit(EXIT_FAILURE); }
+// Same, for the errors that stop the program
+void yyfatal(const char *message, ...);
+#define fatal(...) { yyfatal(__VA_ARGS__); exit(EXIT_FAILURE); }
 // Shows warning for unimplemented feature
 void warn(const char *feature);
 
+/* --- Diagnostics: sink for the errors and warnings */
+
+typedef enum diagnostic_severity_t {
+    DIAGNOSTIC_ERROR, DIAGNOSTIC_WARNING,
+    DIAGNOSTIC_FATAL,  // never captured, deduplicated nor limited
+} diagnostic_severity_t;
+
+typedef struct diagnostics_options_t {
+    size_t max_errors;  // stops the program after this many errors (0 for no limit)
+    size_t max_repeats; // shows each message at most this many times, and sums up the rest
+                        // at the end of the program (0 for no limit)
+    bool   json;        // writes one JSON object per line instead of text
+    bool   dedup;       // drops diagnostics already shown for the same line (same severity and message)
+} diagnostics_options_t;
+
+// Configures the diagnostics; buffers stderr unless it is a terminal, so it should
+// be called before anything is written to stderr
+void diagnostics_init(diagnostics_options_t options);
+// Reports a diagnostic for the current line; for warnings, message is the unimplemented feature
+void diagnostic(diagnostic_severity_t severity, const char *message);
+// If not NULL, receives the diagnostics but the fatal ones instead of the sink (and the
+// line they refer to)
+extern void (*diagnostic_capture)(diagnostic_severity_t severity, const char *message, int line);
+
 #endif
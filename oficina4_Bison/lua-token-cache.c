@@ -0,0 +1,339 @@
+/* lua-token-cache.c: keeps the tokens of a source file between runs of the parser
+
+   The cache (source.luacache) has every token the scanner produces for the
+   source, with its semantic value and line, and also the newlines and the
+   diagnostics of the scanner, so later runs on the same source replay it instead
+   of scanning. The cache is keyed by the size and a hash of the contents of
+   the source, and is regenerated whenever they change. */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "lua-semantics.h"
+#include "lua-parser.tab.h"
+
+/* --- Cache file format: header, records, and a pool with the (null-terminated)
+       names, strings and diagnostic messages, in the byte order of the machine */
+
+#define Cache_magic   "LUACACH"
+#define Cache_version 2
+
+typedef struct cache_header_t {
+    char     magic[8];
+    uint32_t version;
+    uint32_t tokens_signature;
+    uint64_t source_size;
+    uint64_t source_hash;
+    uint64_t records_n;
+    uint64_t pool_size;
+} cache_header_t;
+
+// Pseudo-tokens of the records with scanner diagnostics
+static const int Record_error   = -1;
+static const int Record_warning = -2;
+
+// The scanner entered a string or a comment (and so left error recovery)
+// before producing the record
+static const uint32_t Record_after_context  = 1;
+// The scanner was left inside a string after producing the record
+static const uint32_t Record_inside_context = 2;
+
+typedef struct cache_record_t {
+    int32_t  token;
+    uint32_t flags;
+    int32_t  line;
+    uint32_t offset;  // source offset just after the record
+    union {
+        double   number;
+        uint64_t pool_offset;  // of names, strings and diagnostic messages
+    } value;
+} cache_record_t;
+
+// Tokens with a cached semantic value, or whose numbers must not change
+// between the run that writes the cache and the runs that read it
+static const int Signature_tokens[] = {
+    OR, AND, LT, GT, LE, GE, DIFF, EQUAL, CONCAT, PLUS, MINUS, MULT, DIV, MOD,
+    NOT, LEN, POW, BREAK, DO, ELSE, ELSEIF, END, FALSE, FOR, FUNCTION, IF, IN,
+    IOREAD, LOCAL, NIL, REPEAT, RETURN, THEN, TRUE, UNTIL, WHILE, PRINT,
+    OPEN_BRA, CLOSE_BRA, OPEN_CURLY, CLOSE_CURLY, OPEN_PAR, CLOSE_PAR, COLON,
+    COMMA, DOT, ELLIPSIS, NEWLINE, SEMICOLON, SET, NAME, STRING, NUMBER,
+    YYEOF, YYUNDEF,
+};
+
+// FNV-1a
+static uint64_t hash_bytes(const void *bytes, size_t size, uint64_t hash) {
+    const unsigned char *byte = bytes;
+    for (size_t i=0; i<size; i++) {
+        hash = (hash ^ byte[i]) * UINT64_C(0x100000001B3);
+    }
+    return hash;
+}
+
+static const uint64_t Hash_start = UINT64_C(0xCBF29CE484222325);
+
+static uint32_t tokens_signature(void) {
+    return (uint32_t) hash_bytes(Signature_tokens, sizeof(Signature_tokens), Hash_start);
+}
+
+/* --- Cache contents, either mapped from the cache file or just recorded */
+
+static const char           *source;       // whole source, kept to resume scanning
+static size_t                source_size;
+static const cache_record_t *records;
+static size_t                records_n;
+static const char           *pool;
+static size_t                pool_size;
+
+static bool                  replaying = false;
+static size_t                next_record;
+static const cache_record_t *last_record = NULL;
+
+/* --- Recording of the tokens produced by the scanner */
+
+static cache_record_t *recorded;
+static size_t          recorded_max;
+static char           *recorded_pool;
+static size_t          recorded_pool_max;
+
+// Copies text to the pool, returns its offset there
+static uint64_t record_text(const char *text) {
+    size_t length = strlen(text) + 1;
+    if (pool_size+length > recorded_pool_max) {
+        recorded_pool_max = 2*(pool_size+length);
+        recorded_pool = check_alloc(realloc(recorded_pool, recorded_pool_max));
+    }
+    memcpy(recorded_pool+pool_size, text, length);
+    pool_size += length;
+    return pool_size - length;
+}
+
+static cache_record_t *record_new(int token, int line) {
+    if (records_n == recorded_max) {
+        recorded_max = 2*recorded_max + 1024;
+        recorded = check_alloc(realloc(recorded, recorded_max*sizeof(cache_record_t)));
+    }
+    cache_record_t *record = &recorded[records_n++];
+    record->token = token;
+    record->flags = scanner_context_entered ? Record_after_context : 0;
+    record->line = line;
+    record->offset = scanner_offset;
+    record->value.pool_offset = 0;
+    scanner_context_entered = false;
+    return record;
+}
+
+static void record_diagnostic(diagnostic_severity_t severity, const char *message, int line) {
+    uint64_t pool_offset = record_text(message);
+    int token = severity == DIAGNOSTIC_WARNING ? Record_warning : Record_error;
+    record_new(token, line)->value.pool_offset = pool_offset;
+}
+
+// Scans the whole source, recording the tokens in memory
+static void record_source(void) {
+    int first_line = line_number;
+    records_n = 0;
+    pool_size = 0;
+    scanner_restart(source, source_size);
+    scanner_report_newlines = true;
+    scanner_context_entered = false;
+    diagnostic_capture = record_diagnostic;
+
+    int token;
+    do {
+        token = scanner_lex();
+        uint64_t pool_offset = 0;
+        if (token == NAME) {
+            pool_offset = record_text(yylval.name);
+            free((void *) yylval.name);
+        }
+        else if (token == STRING) {
+            pool_offset = record_text(yylval.string);
+        }
+        cache_record_t *record = record_new(token, line_number);
+        record->value.pool_offset = pool_offset;
+        if (token == NUMBER) {
+            record->value.number = yylval.number;
+        }
+        if (!scanner_in_code()) {
+            record->flags |= Record_inside_context;
+        }
+    } while (token != YYEOF);
+
+    diagnostic_capture = NULL;
+    scanner_report_newlines = false;
+    scanner_end_recovery();
+    line_number = first_line;
+    records = recorded;
+    pool = recorded_pool;
+}
+
+/* --- Cache files */
+
+// Maps the cache file, returns false if it does not exist or does not match the source
+static bool cache_load(const char *cache_path, uint64_t source_hash) {
+    int fd = open(cache_path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size < sizeof(cache_header_t)) {
+        close(fd);
+        return false;
+    }
+    void *mapping = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+
+    const cache_header_t *header = mapping;
+    size_t contents_size = status.st_size - sizeof(cache_header_t);
+    bool valid = memcmp(header->magic, Cache_magic, sizeof(header->magic)) == 0
+              && header->version == Cache_version
+              && header->tokens_signature == tokens_signature()
+              && header->source_size == source_size
+              && header->source_hash == source_hash
+              && header->records_n <= contents_size/sizeof(cache_record_t)
+              && header->records_n*sizeof(cache_record_t) + header->pool_size == contents_size
+              && (header->pool_size == 0 || ((const char *) mapping)[status.st_size-1] == '\0');
+    if (!valid) {
+        munmap(mapping, status.st_size);
+        return false;
+    }
+
+    records = (const cache_record_t *) (header+1);
+    records_n = header->records_n;
+    pool = (const char *) (records+records_n);
+    pool_size = header->pool_size;
+    // The offsets point back into the source when the scanner takes over, so
+    // they must stay inside it and never go backwards
+    for (size_t i=0; i<records_n; i++) {
+        int token = records[i].token;
+        bool in_pool = token == NAME || token == STRING || token == Record_error || token == Record_warning;
+        if ((in_pool && records[i].value.pool_offset >= pool_size)
+            || records[i].offset > source_size
+            || (i > 0 && records[i].offset < records[i-1].offset)) {
+            munmap(mapping, status.st_size);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Writes the recorded tokens to the cache file; a cache that cannot be written
+// is not an error, the source will just be scanned again next time
+static void cache_write(const char *cache_path, uint64_t source_hash) {
+    char *temp_path = check_alloc(malloc(strlen(cache_path)+5));
+    sprintf(temp_path, "%s.tmp", cache_path);
+    FILE *file = fopen(temp_path, "wb");
+    if (file == NULL) {
+        free(temp_path);
+        return;
+    }
+
+    cache_header_t header = {
+        .magic            = Cache_magic,
+        .version          = Cache_version,
+        .tokens_signature = tokens_signature(),
+        .source_size      = source_size,
+        .source_hash      = source_hash,
+        .records_n        = records_n,
+        .pool_size        = pool_size,
+    };
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1
+                && fwrite(records, sizeof(cache_record_t), records_n, file) == records_n
+                && fwrite(pool, 1, pool_size, file) == pool_size;
+    written = fclose(file) == 0 && written;
+    // Renaming makes the new cache appear at once to concurrent runs
+    if (!written || rename(temp_path, cache_path) != 0) {
+        unlink(temp_path);
+    }
+    free(temp_path);
+}
+
+void token_cache_open(const char *source_path) {
+    FILE *source_file = fopen(source_path, "rb");
+    struct stat status;
+    if (source_file == NULL || fstat(fileno(source_file), &status) != 0) {
+        fatal("error opening source file: %s", source_path);
+    }
+    if (status.st_size > UINT32_MAX) {
+        // Offsets in the records have 32 bits: sources this large are simply scanned
+        fclose(source_file);
+        return;
+    }
+    source_size = status.st_size;
+    char *source_contents = check_alloc(malloc(source_size+1));
+    if (fread(source_contents, 1, source_size, source_file) != source_size) {
+        fatal("error reading source file: %s", source_path);
+    }
+    fclose(source_file);
+    source = source_contents;
+
+    uint64_t source_hash = hash_bytes(source, source_size, Hash_start);
+    char *cache_path = check_alloc(malloc(strlen(source_path)+10));
+    sprintf(cache_path, "%s.luacache", source_path);
+    if (!cache_load(cache_path, source_hash)) {
+        record_source();
+        cache_write(cache_path, source_hash);
+    }
+    free(cache_path);
+
+    replaying = true;
+    next_record = 0;
+    last_record = NULL;
+}
+
+/* --- Tokens for the parser */
+
+int yylex(void) {
+    if (!replaying) {
+        return scanner_lex();
+    }
+
+    if (last_record != NULL && (last_record->flags & Record_inside_context) && scanner_in_recovery()) {
+        // The parser started error recovery in the middle of a string, which
+        // the scanner leaves to resynchronize; the cache cannot follow that,
+        // so the rest of the source is scanned
+        replaying = false;
+        scanner_restart(source+last_record->offset, source_size-last_record->offset);
+        scanner_start_recovery();
+        return scanner_lex();
+    }
+
+    while (next_record < records_n) {
+        const cache_record_t *record = &records[next_record++];
+        line_number = record->line;
+        if (record->flags & Record_after_context) {
+            scanner_end_recovery();
+        }
+        if (record->token == Record_error || record->token == Record_warning) {
+            diagnostic(record->token == Record_warning ? DIAGNOSTIC_WARNING : DIAGNOSTIC_ERROR,
+                       pool+record->value.pool_offset);
+            continue;
+        }
+        if (record->token == NEWLINE && !scanner_in_recovery()) {
+            continue;
+        }
+
+        last_record = record;
+        if (record->token == NAME) {
+            yylval.name = pool+record->value.pool_offset;
+        }
+        else if (record->token == STRING) {
+            yylval.string = pool+record->value.pool_offset;
+        }
+        else if (record->token == NUMBER) {
+            yylval.number = record->value.number;
+        }
+        else {
+            yylval.keyword = record->token;
+        }
+        return record->token;
+    }
+    return YYEOF;
+}
@@ -10,7 +10,7 @@ if [ "$?" != "0" ]; then
     echo Error creating scanner!
     exit 1
 fi
-gcc -o lua-parser lua-lexer.c lua-parser.tab.c lua-semantics.c -Wall -lm -std=gnu99
+gcc -o lua-parser lua-lexer.c lua-parser.tab.c lua-semantics.c lua-token-cache.c -Wall -lm -std=gnu99
 if [ "$?" != "0" ]; then
     echo Error creating executable!
     exit 1
@@ -44,6 +44,10 @@ echo Testing controls.lua
 diff controls.out controls.ref
 diff controls.err controls.errref
 
+echo Testing markov.lua with JSON diagnostics and maximum errors
+../lua-parser --json --max-errors 1 markov.lua > /dev/null 2> markov.json
+diff markov.json markov.jsonref
+
 for i in `seq 1 8`; do
     echo Testing sort.lua on input "$i"
     ../lua-parser sort.lua < "sort.in$i" > "sort.out$i"
@@ -56,5 +60,28 @@ for i in `seq 1 9`; do
     diff "find_ascii_code.out$i" "find_ascii_code.ref$i"
 done
 
+rm -f *.luacache
+for run in writing reading; do
+    for f in hello numbers strings operators; do
+        echo Testing $f.lua with token cache "($run)"
+        ../lua-parser --cache $f.lua > $f.out
+        diff $f.out $f.ref
+    done
+
+    for f in markov controls; do
+        echo Testing $f.lua with token cache "($run)"
+        ../lua-parser --cache $f.lua > $f.out 2> $f.err
+        diff $f.out $f.ref
+        diff $f.err $f.errref
+    done
+
+    for i in `seq 1 8`; do
+        echo Testing sort.lua with token cache "($run)" on input "$i"
+        ../lua-parser --cache sort.lua < "sort.in$i" > "sort.out$i"
+        diff "sort.out$i" "sort.ref$i"
+    done
+done
+rm -f *.luacache
+
 echo done!
 cd ../
@@ -0,0 +1,464 @@
+/* Benchmark of the prime number finders, with a scaling report
+
+   Runs each finder over sweeps of N (the number of primes) and P (the number
+   of processes or threads), as separate processes reading their output from
+   a pipe. The harness becomes the reaper of all their descendants, so even
+   the subprocesses that find-primes-parallel-naive leaves behind are waited
+   for: the wall time ends when the last of them exits, and the user and sys
+   times and the context switches, from wait4, cover all of them. The busy
+   time of each core is taken from /proc/stat around the run.
+
+   Every output is verified: it must have N distinct primes (N/P primes P
+   times, for the naive finder, whose processes repeat each other), and the
+   sequences that start at the seed must match prime-numbers.txt.
+
+   Strong scaling keeps N fixed as P grows; weak scaling keeps N/P fixed.
+   Each run is a line of the CSV, and the best of the repetitions of each
+   point goes to the speedup and efficiency tables. */
+
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "primality.h"
+
+/* --- Finders */
+
+typedef enum check_t {
+    Check_prefix,   // a single sequence from the seed
+    Check_copies,   // P copies of the sequence from the seed
+    Check_includes, // P sequences, the first of them from the seed
+    Check_distinct, // sequences not starting at the seed
+} check_t;
+
+typedef struct finder_t {
+    const char *name;
+    bool        parallel; // takes P as second argument
+    bool        divides;  // ...which must divide N
+    check_t     check;
+} finder_t;
+
+static const finder_t Finders[] = {
+    { "find-primes",                false, false, Check_prefix   },
+    { "find-primes-wheel",          false, false, Check_prefix   },
+    { "find-primes-fast",           false, false, Check_prefix   },
+    { "find-primes-parallel-naive", true,  true,  Check_copies   },
+    { "find-primes-parallel",       true,  true,  Check_includes },
+    { "find-primes-fast-parallel",  true,  true,  Check_includes },
+    { "find-primes-threads",        true,  false, Check_distinct },
+};
+#define Finders_n (sizeof(Finders) / sizeof(Finders[0]))
+
+/* --- Measures */
+
+#define Max_cores 256
+#define Max_list  32
+
+typedef struct cpu_times_t {
+    size_t             cores;
+    unsigned long long busy[Max_cores];
+    unsigned long long total[Max_cores];
+} cpu_times_t;
+
+typedef struct run_t {
+    const finder_t *finder;
+    bool            weak;                   // sweep with N/P fixed
+    long            n, p, repetition;
+    double          wall, user, sys;
+    long            voluntary, involuntary; // context switches
+    double          core_busy[Max_cores];   // fraction of the run
+    size_t          cores;
+    bool            verified;
+} run_t;
+
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec*1e-9;
+}
+
+static void read_cpu_times(cpu_times_t *times) {
+    times->cores = 0;
+    FILE *stat = fopen("/proc/stat", "r");
+    if (stat == NULL) {
+        return;
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), stat) != NULL && times->cores < Max_cores) {
+        // Only the lines of each core, "cpuN ...", not the "cpu  ..." of their sum
+        if (strncmp(line, "cpu", 3) != 0 || !isdigit((unsigned char) line[3])) {
+            continue;
+        }
+        unsigned core;
+        unsigned long long user, nice, system, idle, iowait, irq, softirq, steal;
+        if (sscanf(line, "cpu%u %llu %llu %llu %llu %llu %llu %llu %llu", &core, &user, &nice,
+                   &system, &idle, &iowait, &irq, &softirq, &steal) == 9) {
+            times->total[times->cores] = user + nice + system + idle + iowait + irq + softirq + steal;
+            times->busy[times->cores] = times->total[times->cores] - idle - iowait;
+            times->cores++;
+        }
+    }
+    fclose(stat);
+}
+
+/* --- Verification */
+
+static uint64_t Reference[64];
+static size_t Reference_n = 0;
+
+static int compare_uint64(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static size_t count_of(const uint64_t *sorted, size_t n, uint64_t value) {
+    const uint64_t *found = bsearch(&value, sorted, n, sizeof(uint64_t), compare_uint64);
+    if (found == NULL) {
+        return 0;
+    }
+    const uint64_t *first = found, *last = found;
+    while (first > sorted && first[-1] == value) first--;
+    while (last+1 < sorted+n && last[1] == value) last++;
+    return last - first + 1;
+}
+
+static bool verify(const finder_t *finder, long n, long p, char *output) {
+    uint64_t *primes = malloc((n+1) * sizeof(uint64_t));
+    if (primes == NULL) {
+        return false;
+    }
+    size_t found = 0;
+    bool ok = true;
+    for (char *line=strtok(output, "\n"); ok && line!=NULL; line=strtok(NULL, "\n")) {
+        char *notnumber_ptr;
+        errno = 0;
+        const uint64_t prime = strtoull(line, &notnumber_ptr, 10);
+        ok = errno == 0 && *notnumber_ptr == '\0' && found < (size_t) n && miller_rabin(prime);
+        if (ok) {
+            primes[found++] = prime;
+        }
+    }
+    ok = ok && found == (size_t) n;
+
+    // The sequence from the seed, as far as the reference goes
+    const long per_sequence = finder->check == Check_prefix ? n : n/p;
+    const size_t seed_n = per_sequence < (long) Reference_n ? per_sequence : Reference_n;
+    if (ok && finder->check == Check_prefix) {
+        for (size_t i=0; ok && i<seed_n; i++) ok = primes[i] == Reference[i];
+    }
+
+    qsort(primes, found, sizeof(uint64_t), compare_uint64);
+    const size_t copies = finder->check == Check_copies ? p : 1;
+    if (ok && (finder->check == Check_copies || finder->check == Check_includes)) {
+        for (size_t i=0; ok && i<seed_n; i++) ok = count_of(primes, found, Reference[i]) == copies;
+    }
+    if (ok && finder->check != Check_copies) {
+        for (size_t i=1; ok && i<found; i++) ok = primes[i] != primes[i-1];
+    }
+    free(primes);
+    return ok;
+}
+
+/* --- Runs */
+
+// Runs the finder and waits for all the processes it creates, directly or not
+static bool run_finder(run_t *run) {
+    char program[256], n_text[32], p_text[32];
+    snprintf(program, sizeof(program), "./%s", run->finder->name);
+    snprintf(n_text, sizeof(n_text), "%ld", run->n);
+    snprintf(p_text, sizeof(p_text), "%ld", run->p);
+    char *arguments[] = { program, n_text, run->finder->parallel ? p_text : NULL, NULL };
+
+    int pipe_ends[2];
+    if (pipe(pipe_ends) != 0) {
+        return false;
+    }
+    fflush(NULL);
+    cpu_times_t before, after;
+    read_cpu_times(&before);
+    const double start = now();
+
+    const pid_t child = fork();
+    if (child < 0) {
+        close(pipe_ends[0]);
+        close(pipe_ends[1]);
+        return false;
+    }
+    if (child == 0) {
+        dup2(pipe_ends[1], STDOUT_FILENO);
+        close(pipe_ends[0]);
+        close(pipe_ends[1]);
+        execv(program, arguments);
+        fprintf(stderr, "cannot run %s\n", program);
+        _exit(127);
+    }
+    close(pipe_ends[1]);
+
+    // Reads until the last process holding the pipe exits
+    size_t size = 1 << 16, used = 0;
+    char *output = malloc(size);
+    ssize_t got = 0;
+    while (output != NULL && (got = read(pipe_ends[0], output+used, size-1-used)) != 0) {
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        used += got;
+        if (used == size-1) {
+            size *= 2;
+            char *larger = realloc(output, size);
+            if (larger == NULL) free(output);
+            output = larger;
+        }
+    }
+    close(pipe_ends[0]);
+
+    bool exited = false;
+    int status;
+    struct rusage usage;
+    pid_t reaped;
+    run->user = run->sys = 0;
+    run->voluntary = run->involuntary = 0;
+    while ((reaped = wait4(-1, &status, 0, &usage)) > 0 || errno == EINTR) {
+        if (reaped <= 0) continue;
+        if (reaped == child) {
+            exited = WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+        }
+        run->user += usage.ru_utime.tv_sec + usage.ru_utime.tv_usec*1e-6;
+        run->sys += usage.ru_stime.tv_sec + usage.ru_stime.tv_usec*1e-6;
+        run->voluntary += usage.ru_nvcsw;
+        run->involuntary += usage.ru_nivcsw;
+    }
+    run->wall = now() - start;
+    read_cpu_times(&after);
+
+    run->cores = after.cores == before.cores ? after.cores : 0;
+    for (size_t i=0; i<run->cores; i++) {
+        const unsigned long long total = after.total[i] - before.total[i];
+        run->core_busy[i] = total == 0 ? 0 : (double) (after.busy[i] - before.busy[i]) / total;
+    }
+
+    if (output == NULL) {
+        return false;
+    }
+    output[used] = '\0';
+    run->verified = exited && verify(run->finder, run->n, run->p, output);
+    free(output);
+    return true;
+}
+
+static void print_csv_header(FILE *csv) {
+    fprintf(csv, "finder,sweep,n,p,repetition,wall_s,user_s,sys_s,"
+                 "voluntary_switches,involuntary_switches,cpu,core_busy,verified\n");
+}
+
+static void print_csv(FILE *csv, const run_t *run) {
+    // cpu is the mean number of busy cores; core_busy is per core, over the
+    // whole machine, so it also counts other load
+    fprintf(csv, "%s,%s,%ld,%ld,%ld,%.4f,%.4f,%.4f,%ld,%ld,%.3f,", run->finder->name, run->weak ? "weak" : "strong",
+            run->n, run->p, run->repetition, run->wall, run->user, run->sys,
+            run->voluntary, run->involuntary, (run->user + run->sys) / run->wall);
+    for (size_t i=0; i<run->cores; i++) {
+        fprintf(csv, i == 0 ? "%.2f" : ";%.2f", run->core_busy[i]);
+    }
+    fprintf(csv, ",%d\n", run->verified);
+    fflush(csv);
+}
+
+/* --- Report */
+
+// The best of the repetitions of a point, or NULL if it was not run
+static const run_t *best_run(const run_t *runs, size_t runs_n, const finder_t *finder,
+                             bool weak, long n, long p) {
+    const run_t *best = NULL;
+    for (size_t i=0; i<runs_n; i++) {
+        const run_t *run = &runs[i];
+        if (run->finder == finder && run->weak == weak && run->n == n && run->p == p
+                && run->verified && (best == NULL || run->wall < best->wall)) {
+            best = run;
+        }
+    }
+    return best;
+}
+
+// For the weak sweep, size is N/P, and the speedup is scaled by P
+static void print_table(const run_t *runs, size_t runs_n, bool weak, long size,
+                        const long *ps, size_t ps_n) {
+    printf("\n%s scaling, %s = %ld (%ld cores online)\n", weak ? "weak" : "strong", weak ? "N/P" : "N", size,
+           sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-28s %4s %10s %10s %8s %10s %6s\n",
+           "finder", "P", "wall (s)", "cpu (s)", "speedup", "efficiency", "cpu");
+    for (size_t f=0; f<Finders_n; f++) {
+        const run_t *base = best_run(runs, runs_n, &Finders[f], weak, size, 1);
+        for (size_t i=0; i<ps_n && base!=NULL; i++) {
+            const long p = ps[i];
+            const run_t *run = best_run(runs, runs_n, &Finders[f], weak, weak ? size*p : size, p);
+            if (run == NULL) {
+                continue;
+            }
+            const double speedup = (weak ? p : 1) * base->wall / run->wall;
+            printf("%-28s %4ld %10.3f %10.3f %8.2f %10.2f %6.2f\n", Finders[f].name, p,
+                   run->wall, run->user + run->sys, speedup, speedup / p,
+                   (run->user + run->sys) / run->wall);
+        }
+    }
+}
+
+/* --- Main */
+
+static size_t parse_list(char *text, long values[Max_list]) {
+    size_t n = 0;
+    for (char *item=strtok(text, ","); item!=NULL; item=strtok(NULL, ",")) {
+        char *notnumber_ptr;
+        const long value = strtol(item, &notnumber_ptr, 10);
+        if (*notnumber_ptr != '\0' || value <= 0 || n == Max_list) {
+            return 0;
+        }
+        values[n++] = value;
+    }
+    return n;
+}
+
+static bool read_reference(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return false;
+    }
+    const size_t max = sizeof(Reference) / sizeof(Reference[0]);
+    while (Reference_n < max && fscanf(file, "%" SCNu64, &Reference[Reference_n]) == 1) {
+        Reference_n++;
+    }
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    long strong[Max_list], weak[Max_list], ps[1+Max_list] = { 1 }, repetitions = 3;
+    size_t strong_n = 0, weak_n = 0, ps_n = 1;
+    bool chosen[Finders_n] = { false }, any_chosen = false, usage_error = false;
+    const char *csv_path = "bench-primes.csv", *reference_path = "prime-numbers.txt";
+
+    int option;
+    while ((option = getopt(argc, argv, "e:n:w:p:r:o:f:")) != -1) {
+        char *notnumber_ptr;
+        switch (option) {
+        case 'e':
+            for (char *name=strtok(optarg, ","); name!=NULL; name=strtok(NULL, ",")) {
+                size_t f = 0;
+                while (f < Finders_n && strcmp(name, Finders[f].name) != 0) f++;
+                usage_error = usage_error || f == Finders_n;
+                if (f < Finders_n) chosen[f] = any_chosen = true;
+            }
+            break;
+        case 'n': usage_error = usage_error || (strong_n = parse_list(optarg, strong)) == 0; break;
+        case 'w': usage_error = usage_error || (weak_n = parse_list(optarg, weak)) == 0; break;
+        case 'p':
+            // P = 1 is always run, as the base of the speedups
+            ps_n = parse_list(optarg, ps+1) + 1;
+            usage_error = usage_error || ps_n == 1;
+            break;
+        case 'r':
+            repetitions = strtol(optarg, &notnumber_ptr, 10);
+            usage_error = usage_error || *notnumber_ptr != '\0' || repetitions <= 0;
+            break;
+        case 'o': csv_path = optarg; break;
+        case 'f': reference_path = optarg; break;
+        default: usage_error = true;
+        }
+    }
+
+    if (usage_error || optind != argc || strong_n + weak_n == 0) {
+        fprintf(stderr, "usage: bench-primes [-e FINDER,...] [-n N,...] [-w N,...] [-p P,...]\n"
+                        "                    [-r R] [-o CSV] [-f REFERENCE]\n"
+                        "benchmarks the prime number finders (all, or those given by -e)\n"
+                        "finding N primes (strong scaling) or N per process (-w, weak\n"
+                        "scaling) with P processes, R times each (default 3), appending\n"
+                        "the runs to CSV (default bench-primes.csv)\n");
+        return EXIT_FAILURE;
+    }
+    // Drops the repetitions of P = 1
+    size_t unique_n = 1;
+    for (size_t i=1; i<ps_n; i++) {
+        if (ps[i] != 1) ps[unique_n++] = ps[i];
+    }
+    ps_n = unique_n;
+
+    if (!read_reference(reference_path)) {
+        fprintf(stderr, "cannot read %s\n", reference_path);
+        return EXIT_FAILURE;
+    }
+    FILE *csv = fopen(csv_path, "a");
+    if (csv == NULL) {
+        fprintf(stderr, "cannot open %s\n", csv_path);
+        return EXIT_FAILURE;
+    }
+    if (ftell(csv) == 0) {
+        print_csv_header(csv);
+    }
+
+    // Orphans, such as the subprocesses of the naive finder, are reparented
+    // to the harness instead of init, so they can be waited for
+    if (prctl(PR_SET_CHILD_SUBREAPER, 1) != 0) {
+        fprintf(stderr, "warning: cannot wait for orphaned subprocesses\n");
+    }
+
+    const size_t max_runs = Finders_n * (strong_n + weak_n) * ps_n * repetitions;
+    run_t *runs = malloc(max_runs * sizeof(run_t));
+    if (runs == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+    size_t runs_n = 0;
+    bool all_verified = true;
+    for (size_t f=0; f<Finders_n; f++) {
+        if (any_chosen && !chosen[f]) {
+            continue;
+        }
+        for (size_t s=0; s<strong_n+weak_n; s++) {
+            const bool is_weak = s >= strong_n;
+            for (size_t i=0; i<(Finders[f].parallel ? ps_n : 1); i++) {
+                const long p = ps[i];
+                const long n = is_weak ? weak[s-strong_n] * p : strong[s];
+                if (Finders[f].divides && n % p != 0) {
+                    fprintf(stderr, "skipping %s with N = %ld, P = %ld: N must be a multiple of P\n",
+                            Finders[f].name, n, p);
+                    continue;
+                }
+                for (long r=0; r<repetitions; r++) {
+                    run_t *run = &runs[runs_n];
+                    *run = (run_t) { .finder = &Finders[f], .weak = is_weak,
+                                     .n = n, .p = p, .repetition = r };
+                    if (!run_finder(run)) {
+                        fprintf(stderr, "cannot run %s\n", Finders[f].name);
+                        return EXIT_FAILURE;
+                    }
+                    fprintf(stderr, "%s %ld %ld: %.3f s%s\n", Finders[f].name, n, p, run->wall,
+                            run->verified ? "" : ", WRONG OUTPUT");
+                    all_verified = all_verified && run->verified;
+                    print_csv(csv, run);
+                    runs_n++;
+                }
+            }
+        }
+    }
+    fclose(csv);
+
+    for (size_t s=0; s<strong_n; s++) {
+        print_table(runs, runs_n, false, strong[s], ps, ps_n);
+    }
+    for (size_t s=0; s<weak_n; s++) {
+        print_table(runs, runs_n, true, weak[s], ps, ps_n);
+    }
+    free(runs);
+    return all_verified ? EXIT_SUCCESS : EXIT_FAILURE;
+}
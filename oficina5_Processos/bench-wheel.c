@@ -0,0 +1,115 @@
+/* Picks the fastest divisor kernel of wheel.inc on this machine
+
+   Times each kernel on the same trial divisions, after checking that all of
+   them agree, and prints a header defining wheel_divisor as the fastest. */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include <immintrin.h>
+
+#include "primality.h"
+#include "pseudo-random.h"
+
+#include "wheel.inc"
+
+typedef uint64_t (*kernel_t)(uint64_t candidate, uint64_t first, uint64_t last);
+
+typedef struct kernel_entry_t {
+    const char *name;
+    kernel_t    kernel;
+    bool        supported;
+    double      seconds;
+} kernel_entry_t;
+
+// Primes around 2^48 take each a few million trial divisions
+#define Bench_primes 32
+static const int Bench_bits = 48;
+
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec*1e-9;
+}
+
+static uint64_t max_divisor(uint64_t candidate) {
+    return (uint64_t) sqrtl(candidate);
+}
+
+int main(void) {
+    __builtin_cpu_init();
+    kernel_entry_t kernels[] = {
+        { "table", wheel_divisor_table, true },
+#ifdef Wheel_has_unrolled
+        { "unrolled", wheel_divisor_unrolled, true },
+#endif
+#ifdef Wheel_has_simd
+        { "simd", wheel_divisor_simd, __builtin_cpu_supports("avx512dq") },
+#endif
+    };
+    const size_t kernels_n = sizeof(kernels) / sizeof(kernels[0]);
+
+    // Benchmarks on primes, which go through the whole range, and checks on
+    // semiprimes, whose smallest factor is known
+    pseudo_random_t random;
+    pseudo_random_seed_r(&random, 1729);
+    uint64_t primes[Bench_primes], semiprimes[Bench_primes], factors[Bench_primes];
+    for (size_t i=0; i<Bench_primes; i++) {
+        do {
+            primes[i] = pseudo_random_next_r(&random) >> (64-Bench_bits);
+        } while (!miller_rabin(primes[i]));
+        uint64_t other;
+        do {
+            factors[i] = (pseudo_random_next_r(&random) >> 40) | 1;
+            other = pseudo_random_next_r(&random) >> 40 | 1;
+        } while (!miller_rabin(factors[i]) || !miller_rabin(other) || factors[i] <= Wheel_primorial);
+        if (other < factors[i]) {
+            const uint64_t swap = other;
+            other = factors[i];
+            factors[i] = swap;
+        }
+        semiprimes[i] = factors[i] * other;
+    }
+
+    for (size_t k=0; k<kernels_n; k++) {
+        if (!kernels[k].supported) {
+            continue;
+        }
+        for (size_t i=0; i<Bench_primes; i++) {
+            if (kernels[k].kernel(primes[i], 2, max_divisor(primes[i])) != 0 ||
+                kernels[k].kernel(semiprimes[i], 2, max_divisor(semiprimes[i])) != factors[i] ||
+                kernels[k].kernel(semiprimes[i], factors[i]+1, max_divisor(semiprimes[i])) != 0) {
+                fprintf(stderr, "bench-wheel: kernel %s is wrong\n", kernels[k].name);
+                return EXIT_FAILURE;
+            }
+        }
+        const double start = now();
+        for (size_t i=0; i<Bench_primes; i++) {
+            kernels[k].kernel(primes[i], 2, max_divisor(primes[i]));
+        }
+        kernels[k].seconds = now() - start;
+    }
+
+    size_t best = 0;
+    for (size_t k=1; k<kernels_n; k++) {
+        if (kernels[k].supported && kernels[k].seconds < kernels[best].seconds) {
+            best = k;
+        }
+    }
+
+    printf("// [[ ---------- code generated by bench-wheel.c\n");
+    printf("// Fastest kernel of wheel.inc on the build machine:");
+    for (size_t k=0; k<kernels_n; k++) {
+        if (kernels[k].supported) {
+            printf(" %s %.3fs", kernels[k].name, kernels[k].seconds);
+        }
+    }
+    printf("\n#define wheel_divisor wheel_divisor_%s\n", kernels[best].name);
+    printf("// ---------- ]]\n");
+    fprintf(stderr, "bench-wheel: picked the %s kernel\n", kernels[best].name);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,66 @@
+/* Creates a table with the inverses modulo 2^64 of the first odd primes, for
+   testing divisibility with a multiplication instead of a division: n is a
+   multiple of the odd number p iff n*inverse(p) <= (2^64-1)/p
+
+   The primes are kept in the narrowest type that holds them, and the
+   inverses and limits aligned to cache lines: the whole table is read for
+   every candidate, so it should take as few lines as possible.
+*/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "first-primes.inc"
+
+int main(int argc, char *argv[]) {
+    long n = -1;
+    if (argc>1) {
+        char *notnumber_ptr;
+        n = strtol(argv[1], &notnumber_ptr, 10);
+        n = *notnumber_ptr == '\0' ? n : -1;
+    }
+
+    const long primes_n = First_primes_N;
+    if (n<1 || n>=primes_n){
+        fprintf(stderr, "usage: create-inverses <n>\n"
+                        "creates a table of inverses for the first n odd primes\n"
+                        "in first-primes.inc, 1 <= n < %ld.\n", primes_n);
+        return EXIT_FAILURE;
+    }
+
+    // The tables are kept apart, so consecutive primes load as a vector
+    printf("// [[ ---------- code generated by create-inverses.c\n");
+    const uint64_t largest = First_primes[n];
+    const int bits = largest <= UINT16_MAX ? 16 : largest <= UINT32_MAX ? 32 : 64;
+    printf("#define First_inverses_N %ld\n", n);
+    printf("#define First_odd_primes_max %" PRIu64 "\n", largest);
+    printf("static const uint%d_t First_odd_primes[First_inverses_N] = {\n", bits);
+    for (long i=1; i<=n; i++) {
+        printf(i%10 == 1 ? "    %5" PRIu64 "," : " %5" PRIu64 ",", (uint64_t) First_primes[i]);
+        if (i%10 == 0 || i == n) printf("\n");
+    }
+    printf("};\n");
+    printf("_Static_assert(First_odd_primes_max <= UINT%d_MAX, \"primes must fit their type\");\n", bits);
+    printf("static const _Alignas(64) uint64_t First_inverses[First_inverses_N] = {\n");
+    for (long i=1; i<=n; i++) {
+        // Newton's iteration doubles the correct low bits at each step
+        const uint64_t prime = First_primes[i];
+        uint64_t inverse = prime;
+        for (int step=0; step<5; step++) {
+            inverse *= 2 - prime*inverse;
+        }
+        printf(i%3 == 1 ? "    0x%016" PRIx64 "," : " 0x%016" PRIx64 ",", inverse);
+        if (i%3 == 0 || i == n) printf("\n");
+    }
+    printf("};\n");
+    printf("static const _Alignas(64) uint64_t First_limits[First_inverses_N] = {\n");
+    for (long i=1; i<=n; i++) {
+        printf(i%3 == 1 ? "    0x%016" PRIx64 "," : " 0x%016" PRIx64 ",", UINT64_MAX/First_primes[i]);
+        if (i%3 == 0 || i == n) printf("\n");
+    }
+    printf("};\n");
+    printf("// ---------- ]]\n");
+
+    return EXIT_SUCCESS;
+}
@@ -1,28 +1,206 @@
 /* Creates an unrolled loop with the right skips to avoid testing for small
    primes
+
+   With -w, creates instead a whole wheel: the residues that are coprime to
+   the product of the first n primes, the deltas between them, and kernels
+   finding a divisor among the numbers with those residues. The kernels are
+   alternatives to each other, and bench-wheel picks the fastest one.
 */
 
 #include <assert.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
+
+static const int First_primes[] = { 2, 3, 5, 7, 11, 13, 17, 19 };
+
+// Beyond this, the unrolled kernel gets too large to compile
+static const long Unrolled_max_n = 6;
+
+/* --- Kernels
+
+   All of them share the same signature and contract: they return the
+   smallest divisor of candidate in [first, last] that is coprime to the
+   primorial, or 0 if there is none; first must be at least 2, and last
+   below 2^32. Each turn of the wheel covers [k*primorial+1, k*primorial+
+   primorial-1]; the unrolled and SIMD kernels only go through full turns,
+   and leave the partial turns at both ends to the table kernel. */
+
+static const char Table_kernel[] =
+"static inline uint64_t wheel_divisor_table(uint64_t candidate, uint64_t first, uint64_t last) {\n"
+"    uint64_t divisor = first - first%Wheel_primorial + 1;\n"
+"    size_t i = 0;\n"
+"    while (divisor < first) {\n"
+"        divisor += Wheel_deltas[i];\n"
+"        i = i+1 < Wheel_residues_n ? i+1 : 0;\n"
+"    }\n"
+"    while (divisor <= last) {\n"
+"        if (candidate % divisor == 0) return divisor;\n"
+"        divisor += Wheel_deltas[i];\n"
+"        i = i+1 < Wheel_residues_n ? i+1 : 0;\n"
+"    }\n"
+"    return 0;\n"
+"}\n";
+
+// Tests the partial turns at both ends, and loops over the full turns
+static const char Turns_head[] =
+"    const uint64_t first_turn = (first - 1 + Wheel_primorial-1) / Wheel_primorial;\n"
+"    const uint64_t end_turn = (last + 1) / Wheel_primorial;\n"
+"    if (first_turn >= end_turn) {\n"
+"        return wheel_divisor_table(candidate, first, last);\n"
+"    }\n"
+"    uint64_t divisor = wheel_divisor_table(candidate, first, first_turn*Wheel_primorial);\n"
+"    if (divisor != 0) return divisor;\n"
+"    for (uint64_t base=first_turn*Wheel_primorial; base<end_turn*Wheel_primorial; base+=Wheel_primorial) {\n";
+
+static const char Turns_tail[] =
+"    }\n"
+"    return wheel_divisor_table(candidate, end_turn*Wheel_primorial, last);\n"
+"}\n";
+
+// The remainders of 8 divisors at once: the candidate is split in halves of
+// 32 bits, and each half is divided in double precision, which may get the
+// quotient off by one, and so the remainder off by a divisor
+static const char Simd_kernel[] =
+"__attribute__((target(\"avx512f,avx512dq\")))\n"
+"static inline __m512i wheel_remainder_simd(__m512i dividend, __m512d dividend_d,\n"
+"                                           __m512i divisor, __m512d inverse) {\n"
+"    __m512i quotient = _mm512_cvttpd_epu64(_mm512_mul_pd(dividend_d, inverse));\n"
+"    quotient = _mm512_min_epu64(quotient, _mm512_set1_epi64(UINT32_MAX));\n"
+"    __m512i remainder = _mm512_sub_epi64(dividend, _mm512_mul_epu32(quotient, divisor));\n"
+"    const __m512i zero = _mm512_setzero_si512();\n"
+"    remainder = _mm512_mask_add_epi64(remainder, _mm512_cmplt_epi64_mask(remainder, zero), remainder, divisor);\n"
+"    remainder = _mm512_mask_sub_epi64(remainder, _mm512_cmpge_epi64_mask(remainder, divisor), remainder, divisor);\n"
+"    return remainder;\n"
+"}\n"
+"\n"
+"__attribute__((target(\"avx512f,avx512dq\")))\n"
+"static inline uint64_t wheel_divisor_simd(uint64_t candidate, uint64_t first, uint64_t last) {\n"
+"%s"
+"        const __m512i high = _mm512_set1_epi64(candidate >> 32);\n"
+"        const __m512d high_d = _mm512_set1_pd((double) (candidate >> 32));\n"
+"        const __m512d low_d = _mm512_set1_pd((double) (candidate & UINT32_MAX));\n"
+"        for (size_t i=0; i<Wheel_residues_n; i+=8) {\n"
+"            const __m256i residues = _mm256_loadu_si256((const __m256i *) (Wheel_residues+i));\n"
+"            const __m512i divisors = _mm512_add_epi64(_mm512_set1_epi64(base), _mm512_cvtepu32_epi64(residues));\n"
+"            const __m512d inverse = _mm512_div_pd(_mm512_set1_pd(1.0), _mm512_cvtepu64_pd(divisors));\n"
+"            const __m512i high_remainder = wheel_remainder_simd(high, high_d, divisors, inverse);\n"
+"            const __m512i rest = _mm512_or_si512(_mm512_slli_epi64(high_remainder, 32),\n"
+"                                                 _mm512_set1_epi64(candidate & UINT32_MAX));\n"
+"            const __m512d rest_d = _mm512_fmadd_pd(_mm512_cvtepu64_pd(high_remainder),\n"
+"                                                   _mm512_set1_pd(4294967296.0), low_d);\n"
+"            const __mmask8 divides = _mm512_cmpeq_epi64_mask(\n"
+"                wheel_remainder_simd(rest, rest_d, divisors, inverse), _mm512_setzero_si512());\n"
+"            if (divides != 0) return base + Wheel_residues[i + __builtin_ctz(divides)];\n"
+"        }\n"
+"%s";
+
+/* --- Wheel */
+
+static void print_wheel(long n) {
+    uint32_t primorial = 1;
+    for (long i=0; i<n; i++) {
+        primorial *= First_primes[i];
+    }
+
+    uint32_t *residues = malloc(primorial * sizeof(uint32_t));
+    assert(residues != NULL);
+    size_t residues_n = 0;
+    for (uint32_t residue=1; residue<primorial; residue++) {
+        bool keep = true;
+        for (long i=0; keep && i<n; i++) keep = residue%First_primes[i] != 0;
+        if (keep) residues[residues_n++] = residue;
+    }
+
+    printf("// [[ ---------- code generated by create-test.c\n");
+    printf("// Wheel of the first %ld primes: %zu residues modulo %" PRIu32 "\n",
+           n, residues_n, primorial);
+    printf("#define Wheel_primes_n %ld\n", n);
+    printf("#define Wheel_primorial %" PRIu32 "\n", primorial);
+    printf("#define Wheel_residues_n %zu\n", residues_n);
+    printf("static const uint32_t Wheel_first_primes[Wheel_primes_n] = {");
+    for (long i=0; i<n; i++) {
+        printf(i == 0 ? " %d" : ", %d", First_primes[i]);
+    }
+    printf(" };\n");
+
+    printf("static const uint32_t Wheel_residues[Wheel_residues_n] = {\n");
+    for (size_t i=0; i<residues_n; i++) {
+        printf(i%10 == 0 ? "    %7" PRIu32 "," : " %7" PRIu32 ",", residues[i]);
+        if (i%10 == 9 || i == residues_n-1) printf("\n");
+    }
+    printf("};\n");
+
+    // From each residue to the next, the last wrapping around to the next turn
+    printf("static const uint8_t Wheel_deltas[Wheel_residues_n] = {\n");
+    for (size_t i=0; i<residues_n; i++) {
+        const uint32_t next = i+1 < residues_n ? residues[i+1] : primorial + residues[0];
+        assert(next - residues[i] <= UINT8_MAX);
+        printf(i%20 == 0 ? "    %2" PRIu32 "," : " %2" PRIu32 ",", next - residues[i]);
+        if (i%20 == 19 || i == residues_n-1) printf("\n");
+    }
+    printf("};\n\n");
+
+    printf("%s\n", Table_kernel);
+
+    if (n <= Unrolled_max_n) {
+        printf("#define Wheel_has_unrolled\n");
+        printf("static inline uint64_t wheel_divisor_unrolled(uint64_t candidate, uint64_t first, uint64_t last) {\n");
+        printf("%s", Turns_head);
+        for (size_t i=0; i<residues_n; i++) {
+            printf("        if (candidate %% (base+%" PRIu32 ") == 0) return base+%" PRIu32 ";\n",
+                   residues[i], residues[i]);
+        }
+        printf("%s\n", Turns_tail);
+    }
+    else {
+        printf("// No unrolled kernel: it would be too large\n\n");
+    }
+
+    if (residues_n % 8 == 0) {
+        printf("#define Wheel_has_simd\n");
+        printf(Simd_kernel, Turns_head, Turns_tail);
+    }
+    else {
+        printf("// No SIMD kernel: the residues do not fill whole vectors\n");
+    }
+    printf("// ---------- ]]\n");
+
+    fprintf(stderr, "residues: %zu, fraction: %.4f\n",
+            residues_n, ((float)residues_n)/primorial);
+    free(residues);
+}
+
+/* --- Main */
 
 int main(int argc, char *argv[]) {
+    const bool wheel = argc>1 && strcmp(argv[1], "-w") == 0;
+    const long max_n = wheel ? (long) (sizeof(First_primes)/sizeof(First_primes[0])) : 5;
     long n = -1;
-    if (argc>1) {
+    if (argc == 2+wheel) {
         char *notnumber_ptr;
-        n = strtol(argv[1], &notnumber_ptr, 10);
+        n = strtol(argv[1+wheel], &notnumber_ptr, 10);
         n = *notnumber_ptr == '\0' ? n : -1;
     }
 
-    if (n<1 || n>5){
+    if (n<1 || n>max_n){
         fprintf(stderr, "usage: create-test <n>\n"
+                        "       create-test -w <n>\n"
                         "creates a test allowing to skip the first n primes\n"
-                        "in a primality test,  1 <= n <= 5.\n");
+                        "in a primality test,  1 <= n <= 5; or (-w) a wheel\n"
+                        "skipping them, with tables and divisor kernels,\n"
+                        "1 <= n <= %ld.\n", (long) (sizeof(First_primes)/sizeof(First_primes[0])));
         return EXIT_FAILURE;
     }
 
-    const int first_primes[] = { 2, 3, 5, 7, 11 };
+    if (wheel) {
+        print_wheel(n);
+        return EXIT_SUCCESS;
+    }
+
+    const int *first_primes = First_primes;
     int primorial = 1;
     for (size_t i=0; i<n; i++) {
         primorial *= first_primes[i];
@@ -0,0 +1,209 @@
+/* Factors 64-bit numbers read from stdin, in parallel with threads
+
+   The numbers, separated by blanks or newlines, are read in batches. The
+   threads claim the chunks of each batch in turn, and write the factors of
+   each chunk to an output buffer of its own; once the batch is done, the
+   main thread writes the buffers in order and reads the next batch. The
+   output has a line for each number, as in coreutils' factor:
+
+       60: 2 2 3 5 */
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "primality.h"
+
+// Numbers per chunk: enough to make claiming a chunk negligible, few enough
+// for the threads to share the slower numbers of a batch
+#define Chunk_numbers 256
+#define Batch_chunks  64
+
+// Longest line: a number of 20 digits and its colon, up to 64 factors with
+// at most 20+64 digits in all (the digits of a product are at most the
+// sum of the digits of its factors), a blank before each, and the newline
+#define Line_max (21 + 84 + 64 + 1)
+
+typedef struct chunk_t {
+    uint64_t numbers[Chunk_numbers];
+    size_t   numbers_n;
+    char     output[Chunk_numbers*Line_max];
+    size_t   used;
+} chunk_t;
+
+typedef struct batch_t {
+    chunk_t           chunks[Batch_chunks];
+    size_t            chunks_n;
+    atomic_size_t     next_chunk;
+    bool              done;  // no more batches: the threads must exit
+    pthread_barrier_t start, finish;
+} batch_t;
+
+/* --- Input */
+
+// Reads the next number into n; returns false at the end of the input.
+// Tokens that are not numbers of 64 bits are reported and skipped.
+static bool read_number(uint64_t *n, bool *valid) {
+    int c = getc_unlocked(stdin);
+    while (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+        c = getc_unlocked(stdin);
+    }
+    for (;;) {
+        if (c == EOF) {
+            return false;
+        }
+        char token[24];
+        size_t length = 0;
+        bool number = true, truncated = false;
+        uint64_t value = 0;
+        for (; c != EOF && c != ' ' && c != '\t' && c != '\n' && c != '\r'; c = getc_unlocked(stdin)) {
+            const unsigned digit = (unsigned) c - '0';
+            number = number && digit < 10 && value <= (UINT64_MAX - digit) / 10;
+            value = value*10 + digit;
+            if (length < sizeof(token)-1) {
+                token[length++] = c;
+            }
+            else {
+                truncated = true;
+            }
+        }
+        if (number) {
+            *n = value;
+            return true;
+        }
+        token[length] = '\0';
+        fprintf(stderr, "factor: '%s%s' is not a valid number of 64 bits\n",
+                token, truncated ? "..." : "");
+        *valid = false;
+        while (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+            c = getc_unlocked(stdin);
+        }
+    }
+}
+
+// Fills the chunks of the batch; returns false if the input had no numbers
+static bool read_batch(batch_t *batch, bool *valid) {
+    batch->chunks_n = 0;
+    for (size_t k=0; k<Batch_chunks; k++) {
+        chunk_t *chunk = &batch->chunks[k];
+        chunk->numbers_n = 0;
+        while (chunk->numbers_n < Chunk_numbers && read_number(&chunk->numbers[chunk->numbers_n], valid)) {
+            chunk->numbers_n++;
+        }
+        if (chunk->numbers_n == 0) {
+            break;
+        }
+        batch->chunks_n++;
+        if (chunk->numbers_n < Chunk_numbers) {
+            break;
+        }
+    }
+    atomic_store_explicit(&batch->next_chunk, 0, memory_order_relaxed);
+    return batch->chunks_n > 0;
+}
+
+/* --- Output, formatted by hand in the buffer of each chunk */
+
+static size_t format_number(char *text, uint64_t n) {
+    char digits[20];
+    int length = 0;
+    do {
+        digits[length++] = '0' + n%10;
+        n /= 10;
+    } while (n > 0);
+    for (int i=0; i<length; i++) {
+        text[i] = digits[length-1-i];
+    }
+    return length;
+}
+
+static void factor_chunk(chunk_t *chunk) {
+    chunk->used = 0;
+    for (size_t i=0; i<chunk->numbers_n; i++) {
+        uint64_t factors[Factors_max];
+        const int count = factorize(chunk->numbers[i], factors);
+        char *line = chunk->output + chunk->used;
+        size_t length = format_number(line, chunk->numbers[i]);
+        line[length++] = ':';
+        for (int k=0; k<count; k++) {
+            line[length++] = ' ';
+            length += format_number(line+length, factors[k]);
+        }
+        line[length++] = '\n';
+        chunk->used += length;
+    }
+}
+
+/* --- Threads */
+
+static void *worker_run(void *argument) {
+    batch_t *batch = argument;
+    for (;;) {
+        pthread_barrier_wait(&batch->start);
+        if (batch->done) {
+            return NULL;
+        }
+        size_t k;
+        while ((k = atomic_fetch_add_explicit(&batch->next_chunk, 1, memory_order_relaxed)) < batch->chunks_n) {
+            factor_chunk(&batch->chunks[k]);
+        }
+        pthread_barrier_wait(&batch->finish);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    long t = argc == 1 ? sysconf(_SC_NPROCESSORS_ONLN) : -1;
+    if (argc == 2) {
+        char *notnumber_ptr;
+        t = strtol(argv[1], &notnumber_ptr, 10);
+        t = *notnumber_ptr == '\0' ? t : -1;
+    }
+
+    if (argc > 2 || t <= 0) {
+        fprintf(stderr, "usage: factor [T]\n"
+                        "factors the numbers read from stdin using T Threads (one per core, by default)\n");
+        return EXIT_FAILURE;
+    }
+
+    batch_t *batch = malloc(sizeof(batch_t));
+    pthread_t *threads = malloc(t*sizeof(pthread_t));
+    if (batch == NULL || threads == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+    batch->done = false;
+    pthread_barrier_init(&batch->start, NULL, t+1);
+    pthread_barrier_init(&batch->finish, NULL, t+1);
+    for (long i=0; i<t; i++) {
+        if (pthread_create(&threads[i], NULL, worker_run, batch) != 0) {
+            // The barriers count on all threads: nothing can be done without them
+            fprintf(stderr, "error creating threads\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    bool valid = true;
+    while (read_batch(batch, &valid)) {
+        pthread_barrier_wait(&batch->start);
+        pthread_barrier_wait(&batch->finish);
+        for (size_t k=0; k<batch->chunks_n; k++) {
+            fwrite(batch->chunks[k].output, 1, batch->chunks[k].used, stdout);
+        }
+    }
+    batch->done = true;
+    pthread_barrier_wait(&batch->start);
+    for (long i=0; i<t; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_barrier_destroy(&batch->start);
+    pthread_barrier_destroy(&batch->finish);
+    free(threads);
+    free(batch);
+    return valid && fflush(stdout) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
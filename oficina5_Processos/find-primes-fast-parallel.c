@@ -1,56 +1,284 @@
-/* Faster prime number finder, parallel implementation */
+/* Faster prime number finder, parallel implementation
 
-#include <assert.h>
+   The main process supervises P worker processes, worker i drawing its
+   candidates from the subsequence of the seed jumped i times. The workers
+   do not write the output: each posts its primes to a ring of its own, in
+   memory shared with the main process, which prints them. Each prime goes
+   with the progress of its worker just after it (generator state at the
+   start of the batch, position in the batch, and primes found), so the main
+   process always knows where each worker should continue for the output to
+   have no repetitions and no gaps. The workers sleep on a futex when their
+   ring is full, and the main process when all rings are empty.
+
+   Every second, the main process saves that progress to a state file,
+   written to a temporary file and renamed over the old one, so the file is
+   always complete; when stderr is a terminal, it also reports the
+   throughput.
+
+   A worker that crashes is restarted after the last prime it posted. If the
+   search itself is interrupted (SIGINT, SIGTERM or SIGHUP), the main
+   process stops the workers, prints what they posted, saves their state,
+   and the search can continue with --resume, appending to whatever output
+   the interrupted run produced. Only if the whole process tree is killed
+   at once are the primes found since the last save printed again after the
+   resume. */
+
+#include <errno.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <math.h>
+#include <string.h>
 #include <time.h>
 
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include "primality.h"
 #include "pseudo-random.h"
 
-// Test primes up to 9239, the next would be 9241
-const size_t First_primes_N = 1145;
-const uint64_t First_large = 9240; // primorial(5)==2310, 9240==4*2310
+#define State_path "find-primes-fast-parallel.state"
+
+// Seconds between saves of the state file
+#define Checkpoint_seconds 1
+
+// Crashes tolerated from each worker before the search gives up
+#define Max_restarts 3
+
+// Records in the ring of each worker
+#define Ring_records 4096
+
+// Records waiting in a ring before its worker wakes up the main process;
+// fewer wait until the main process wakes up by itself
+#define Wake_records 256
+
+// Longest sleep on a futex, in nanoseconds, so a missed wake up or a signal
+// is never waited for long
+#define Wait_ns 100000000
+
+/* --- Futexes, shared between processes (thus not FUTEX_PRIVATE) */
+
+static void futex_wait(atomic_uint *word, unsigned expected) {
+    const struct timespec timeout = { 0, Wait_ns };
+    syscall(SYS_futex, word, FUTEX_WAIT, expected, &timeout, NULL, 0);
+}
+
+static void futex_wake(atomic_uint *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/* --- Progress of a worker */
+
+typedef struct progress_t {
+    pseudo_random_t random; // generator at the start of the batch
+    uint64_t        index;  // next candidate of the batch to test
+    uint64_t        found;
+} progress_t;
+
+/* --- Rings, with a single producer (a worker) and a single consumer (the
+       main process) */
+
+// A prime and the progress of its worker just after it, in a cache line
+typedef struct record_t {
+    _Alignas(64) uint64_t prime;
+    uint64_t index, found;
+    uint64_t state[4];
+} record_t;
+
+typedef struct ring_t {
+    _Alignas(64) atomic_size_t head; // next record to read
+    atomic_uint   freed;             // futex, advanced when read while full
+    _Alignas(64) atomic_size_t tail; // next record to write
+    atomic_bool   producer_waiting;
+    record_t      records[Ring_records];
+} ring_t;
+
+typedef struct shared_t {
+    _Alignas(64) atomic_uint posted; // futex, advanced by every record
+    atomic_bool  consumer_waiting;
+    atomic_bool  stop;
+    ring_t       rings[];
+} shared_t;
+
+// Posts a prime, waiting for room; gives up if stop is raised
+static bool ring_post(shared_t *shared, ring_t *ring, uint64_t prime, const progress_t *progress,
+                      bool last) {
+    const size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    for (;;) {
+        const unsigned freed = atomic_load(&ring->freed);
+        if (tail - atomic_load_explicit(&ring->head, memory_order_acquire) < Ring_records) {
+            break;
+        }
+        if (atomic_load_explicit(&shared->stop, memory_order_relaxed)) {
+            return false;
+        }
+        // Sleeps unless the main process reads the ring in the meantime
+        atomic_store(&ring->producer_waiting, true);
+        if (tail - atomic_load(&ring->head) == Ring_records) {
+            futex_wait(&ring->freed, freed);
+        }
+        atomic_store_explicit(&ring->producer_waiting, false, memory_order_relaxed);
+    }
+
+    record_t *record = &ring->records[tail % Ring_records];
+    record->prime = prime;
+    record->index = progress->index;
+    record->found = progress->found;
+    for (int i=0; i<4; i++) {
+        record->state[i] = progress->random.state[i];
+    }
+    atomic_store_explicit(&ring->tail, tail+1, memory_order_release);
+    atomic_fetch_add(&shared->posted, 1);
+    if ((last || tail+1 - atomic_load(&ring->head) >= Wake_records)
+            && atomic_load(&shared->consumer_waiting)) {
+        futex_wake(&shared->posted);
+    }
+    return true;
+}
 
-#include "first-primes.inc"
+/* --- State file: the arguments, then a line per worker */
 
-bool is_prime(const uint64_t candidate) {
-    if (candidate <= 1) {
+static bool save_state(const progress_t *printed, long n, long p) {
+    FILE *file = fopen(State_path ".tmp", "w");
+    if (file == NULL) {
         return false;
     }
-    // First, check if number is divisible by small primes
-    for (size_t i=0; i<First_primes_N; i++) {
-        if (candidate % First_primes[i] == 0) return false;
+    fprintf(file, "find-primes-fast-parallel %ld %ld\n", n, p);
+    for (long i=0; i<p; i++) {
+        fprintf(file, "%" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+                printed[i].found, printed[i].index, printed[i].random.state[0],
+                printed[i].random.state[1], printed[i].random.state[2], printed[i].random.state[3]);
     }
+    bool ok = fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = fclose(file) == 0 && ok;
+    return ok && rename(State_path ".tmp", State_path) == 0;
+}
 
-    // Then check large divisors
-    const uint64_t max_divisor = (uint64_t) sqrtl(candidate);
-    for (uint64_t divisor=First_large; divisor<=max_divisor; divisor+=2310) {
-        if (
-            #include "prime-test-skip2-3-5-7-11.inc"
-           ) return false;
+static bool load_state(progress_t *printed, long n, long p) {
+    FILE *file = fopen(State_path, "r");
+    if (file == NULL) {
+        return false;
+    }
+    long saved_n, saved_p;
+    bool ok = fscanf(file, "find-primes-fast-parallel %ld %ld", &saved_n, &saved_p) == 2
+           && saved_n == n && saved_p == p;
+    for (long i=0; ok && i<p; i++) {
+        progress_t *progress = &printed[i];
+        ok = fscanf(file, "%" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64,
+                    &progress->found, &progress->index, &progress->random.state[0],
+                    &progress->random.state[1], &progress->random.state[2],
+                    &progress->random.state[3]) == 6
+          && progress->index <= Prefilter_batch && progress->found <= (uint64_t) (n/p);
+    }
+    fclose(file);
+    return ok;
+}
+
+/* --- Workers */
+
+static void run_worker(shared_t *shared, ring_t *ring, const progress_t *start, long n_per_s) {
+    progress_t progress = *start;
+    while (progress.found < (uint64_t) n_per_s
+           && !atomic_load_explicit(&shared->stop, memory_order_relaxed)) {
+        const pseudo_random_t batch_start = progress.random;
+        uint64_t candidates[Prefilter_batch];
+        for (size_t i=0; i<Prefilter_batch; i++) {
+            candidates[i] = pseudo_random_next_r(&progress.random);
+        }
+        // The batched trial division discards most candidates, the few left
+        // are settled one by one
+        const unsigned survivors = prefilter_batch(candidates);
+        for (size_t i=progress.index; i<Prefilter_batch && progress.found<(uint64_t) n_per_s; i++) {
+            if ((survivors >> i & 1) && miller_rabin(candidates[i])) {
+                const progress_t after = { batch_start, i+1, progress.found+1 };
+                if (!ring_post(shared, ring, candidates[i], &after, after.found == (uint64_t) n_per_s)) {
+                    return;
+                }
+                progress.found++;
+            }
+        }
+        progress.index = 0;
     }
-    return true;
+}
+
+// The worker keeps the signals of the main process blocked: those sent to
+// the whole process group, as by Ctrl-C, reach it through the stop flag
+static pid_t start_worker(shared_t *shared, long i, const progress_t *progress, long n_per_s) {
+    const pid_t supervisor = getpid();
+    const pid_t worker = fork();
+    if (worker != 0) {
+        return worker;
+    }
+    // Does not outlive the main process
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (getppid() != supervisor) {
+        _exit(EXIT_FAILURE);
+    }
+    run_worker(shared, &shared->rings[i], progress, n_per_s);
+    _exit(EXIT_SUCCESS);
+}
+
+/* --- Main process */
+
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec*1e-9;
+}
+
+// Prints the primes posted to all rings, and keeps the progress of their
+// workers; returns how many
+static long print_posted(shared_t *shared, long p, progress_t *printed) {
+    long count = 0;
+    for (long i=0; i<p; i++) {
+        ring_t *ring = &shared->rings[i];
+        const size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        const size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        for (size_t r=head; r!=tail; r++) {
+            const record_t *record = &ring->records[r % Ring_records];
+            printf("%" PRIu64 "\n", record->prime);
+            printed[i].index = record->index;
+            printed[i].found = record->found;
+            for (int j=0; j<4; j++) {
+                printed[i].random.state[j] = record->state[j];
+            }
+        }
+        if (tail == head) {
+            continue;
+        }
+        count += tail - head;
+        atomic_store(&ring->head, tail);
+        if (atomic_load(&ring->producer_waiting)) {
+            atomic_fetch_add(&ring->freed, 1);
+            futex_wake(&ring->freed);
+        }
+    }
+    return count;
 }
 
 int main(int argc, char *argv[]) {
+    const bool resume = argc > 1 && strcmp(argv[1], "--resume") == 0;
     long n = -1, p = -1;
-    if (argc > 2) {
+    if (argc > 2+resume) {
         char *notnumber_ptr;
-        n = strtol(argv[1], &notnumber_ptr, 10);
+        n = strtol(argv[1+resume], &notnumber_ptr, 10);
         n = *notnumber_ptr == '\0' ? n : -1;
-        p = strtol(argv[2], &notnumber_ptr, 10);
+        p = strtol(argv[2+resume], &notnumber_ptr, 10);
         p = *notnumber_ptr == '\0' ? p : -1;
     }
 
     if (n < 0 || p <= 0) {
-        fprintf(stderr, "usage: find-primes-fast-parallel <N> <P>\n"
-                        "finds N (large) prime Numbers using P Processes\n");
+        fprintf(stderr, "usage: find-primes-fast-parallel [--resume] <N> <P>\n"
+                        "finds N (large) prime Numbers using P Processes, saving\n"
+                        "their progress to " State_path ";\n"
+                        "with --resume, continues the search saved there\n");
         return EXIT_FAILURE;
     }
 
@@ -59,49 +287,160 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
-    // sanity checks
-    assert(First_primes_N < First_primes_len);
-    assert(First_primes[First_primes_N] > First_large);
-    assert(First_primes[First_primes_N-1] < First_large);
-
-    // Initializes the random generator for all subprocesses
-    // pseudo_random_seed((uint64_t) clock()); // for varying results each time
-    pseudo_random_seed(1729); // for benchmarking with predictable results
-
-    // Creates suprocesses
-    pid_t child;
-    for (long i=0; i<p-1; i++) {
-        // Duplicates the process
-        child = fork();
-        if (child < 0) {
-            fprintf(stderr, "error creating subprocesses\n");
+    shared_t *shared = mmap(NULL, sizeof(shared_t) + p*sizeof(ring_t), PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    progress_t *printed = aligned_alloc(_Alignof(progress_t), p*sizeof(progress_t));
+    pid_t *workers = calloc(p, sizeof(pid_t));
+    int *restarts = calloc(p, sizeof(int));
+    if (shared == MAP_FAILED || printed == NULL || workers == NULL || restarts == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+    if (resume) {
+        if (!load_state(printed, n, p)) {
+            fprintf(stderr, "cannot resume: " State_path " missing or not from a search of %ld primes "
+                            "with %ld processes\n", n, p);
             return EXIT_FAILURE;
         }
-        else if (child > 0) {
-            // we are in the parent branch: breaks and start processing
-            break;
+    }
+    else {
+        // Advances the random generator of each worker so the numbers do not
+        // overlap
+        progress_t progress = { .index = 0, .found = 0 };
+        // pseudo_random_seed_r(&progress.random, (uint64_t) clock()); // for varying results each time
+        pseudo_random_seed_r(&progress.random, 1729); // for benchmarking with predictable results
+        for (long i=0; i<p; i++) {
+            printed[i] = progress;
+            pseudo_random_jump_r(&progress.random);
         }
-        // We are in the child branch, advances the random generator so the
-        // numbers do not overlap...
-        pseudo_random_jump();
-        // ...and duplicates the process again if necessary
     }
 
-    // Perform computation
+    // The signals are taken synchronously, by sigtimedwait
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGCHLD);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    sigprocmask(SIG_BLOCK, &signals, NULL);
+    fflush(stdout);
+
+    // Creates the subprocesses
     const long n_per_s = n/p;
-    long found = 0;
-    while (found < n_per_s) {
-        uint64_t candidate = pseudo_random_next();
-        if (is_prime(candidate)) {
-            found++;
-            printf("%" PRIu64 "\n", candidate);
+    long remaining = 0;
+    bool failed = false;
+    for (long i=0; i<p && !failed; i++) {
+        if (printed[i].found < (uint64_t) n_per_s) {
+            remaining++;
+            workers[i] = start_worker(shared, i, &printed[i], n_per_s);
+            failed = workers[i] < 0;
+        }
+    }
+    if (failed) {
+        fprintf(stderr, "error creating subprocesses\n");
+    }
+
+    // Prints the primes as they come, saves the progress periodically, and
+    // restarts the workers that crash, until all are done or something fails
+    const bool report = isatty(STDERR_FILENO);
+    const double start = now();
+    double last_save = start;
+    long total = 0;
+    int stop_signal = 0;
+    while (remaining > 0 && !failed && stop_signal == 0) {
+        const unsigned posted = atomic_load(&shared->posted);
+        const long count = print_posted(shared, p, printed);
+        total += count;
+        const double time = now();
+        const bool idle = count == 0, due = time - last_save >= Checkpoint_seconds;
+
+        // The signals are looked at when there is nothing to print, or at
+        // least at each save
+        const struct timespec no_wait = { 0, 0 };
+        int received;
+        while ((idle || due) && (received = sigtimedwait(&signals, NULL, &no_wait)) > 0) {
+            if (received != SIGCHLD) {
+                stop_signal = received;
+            }
+        }
+        int status;
+        pid_t reaped;
+        while ((idle || due) && stop_signal == 0 && !failed
+               && (reaped = waitpid(-1, &status, WNOHANG)) > 0) {
+            long i = 0;
+            while (i < p && workers[i] != reaped) i++;
+            if (i == p || (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS)) {
+                continue;
+            }
+            if (restarts[i]++ == Max_restarts) {
+                fprintf(stderr, "worker %ld crashed too many times\n", i);
+                failed = true;
+                break;
+            }
+            // What it posted is printed first, and it continues right after
+            fprintf(stderr, "worker %ld crashed, restarting after its last prime\n", i);
+            total += print_posted(shared, p, printed);
+            workers[i] = start_worker(shared, i, &printed[i], n_per_s);
+            failed = workers[i] < 0;
+            if (failed) {
+                fprintf(stderr, "error creating subprocesses\n");
+            }
+        }
+
+        if (idle || due) {
             fflush(stdout);
         }
+        if (due) {
+            last_save = time;
+            if (!save_state(printed, n, p)) {
+                fprintf(stderr, "cannot save " State_path "\n");
+                failed = true;
+            }
+            if (report) {
+                fprintf(stderr, "\r%ld primes, %.0f primes/s", total, total / (time - start));
+            }
+        }
+
+        remaining = 0;
+        for (long i=0; i<p; i++) {
+            remaining += printed[i].found < (uint64_t) n_per_s;
+        }
+        if (idle && remaining > 0 && !failed && stop_signal == 0) {
+            atomic_store(&shared->consumer_waiting, true);
+            futex_wait(&shared->posted, posted);
+            atomic_store_explicit(&shared->consumer_waiting, false, memory_order_relaxed);
+        }
+    }
+    if (report) {
+        fprintf(stderr, "\r%ld primes, %.0f primes/s\n", total, total / (now() - start));
     }
 
-    // Waits for the child to terminate
-    if (child > 0) {
-        waitpid(child, NULL, 0);
+    // Stops the remaining workers, if any, and prints what they posted
+    atomic_store(&shared->stop, true);
+    for (long i=0; i<p; i++) {
+        atomic_fetch_add(&shared->rings[i].freed, 1);
+        futex_wake(&shared->rings[i].freed);
+    }
+    while (wait(NULL) > 0 || errno == EINTR) {
+    }
+    print_posted(shared, p, printed);
+    fflush(stdout);
+    free(workers);
+    free(restarts);
+
+    remaining = 0;
+    for (long i=0; i<p; i++) {
+        remaining += printed[i].found < (uint64_t) n_per_s;
+    }
+    if (remaining == 0) {
+        remove(State_path);
+        return EXIT_SUCCESS;
+    }
+    if (!save_state(printed, n, p)) {
+        fprintf(stderr, "cannot save " State_path "\n");
+        return EXIT_FAILURE;
     }
-    return EXIT_SUCCESS;
+    fprintf(stderr, "search stopped, continue it with: find-primes-fast-parallel --resume %ld %ld\n",
+            n, p);
+    return stop_signal != 0 ? 128 + stop_signal : EXIT_FAILURE;
 }
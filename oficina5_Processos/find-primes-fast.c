@@ -1,41 +1,13 @@
 /* Faster prime number finder */
 
-#include <assert.h>
 #include <inttypes.h>
-#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <math.h>
 #include <time.h>
 
+#include "primality.h"
 #include "pseudo-random.h"
 
-// Test primes up to 9239, the next would be 9241
-const size_t First_primes_N = 1145;
-const uint64_t First_large = 9240; // primorial(5)==2310, 9240==4*2310
-
-#include "first-primes.inc"
-
-bool is_prime(const uint64_t candidate) {
-    if (candidate <= 1) {
-        return false;
-    }
-    // First, check if number is divisible by small primes
-    for (size_t i=0; i<First_primes_N; i++) {
-        if (candidate % First_primes[i] == 0) return false;
-    }
-
-    // Then check large divisors
-    const uint64_t max_divisor = (uint64_t) sqrtl(candidate);
-    for (uint64_t divisor=First_large; divisor<=max_divisor; divisor+=2310) {
-        if (
-            #include "prime-test-skip2-3-5-7-11.inc"
-           ) return false;
-    }
-    return true;
-}
-
-
 int main(int argc, char *argv[]) {
     long n = -1;
     if (argc > 1) {
@@ -50,21 +22,24 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
-    // sanity checks
-    assert(First_primes_N < First_primes_len);
-    assert(First_primes[First_primes_N] > First_large);
-    assert(First_primes[First_primes_N-1] < First_large);
-
     // pseudo_random_seed((uint64_t) clock()); // for varying results each time
     pseudo_random_seed(1729); // for benchmarking with predictable results
 
     long found = 0;
     while (found < n) {
-        uint64_t candidate = pseudo_random_next();
-        if (is_prime(candidate)) {
-            found++;
-            printf("%" PRIu64 "\n", candidate);
-            fflush(stdout);
+        uint64_t candidates[Prefilter_batch];
+        for (size_t i=0; i<Prefilter_batch; i++) {
+            candidates[i] = pseudo_random_next();
+        }
+        // The batched trial division discards most candidates, the few left
+        // are settled one by one
+        const unsigned survivors = prefilter_batch(candidates);
+        for (size_t i=0; i<Prefilter_batch && found<n; i++) {
+            if ((survivors >> i & 1) && miller_rabin(candidates[i])) {
+                found++;
+                printf("%" PRIu64 "\n", candidates[i]);
+                fflush(stdout);
+            }
         }
     }
 
@@ -0,0 +1,65 @@
+/* Prime number finder for whole ranges, with a segmented sieve */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "prime-sieve.h"
+
+// Output is formatted by hand in a large buffer: ranges can have billions of primes
+typedef struct output_t {
+    char   buffer[1 << 16];
+    size_t used;
+} output_t;
+
+static void output_flush(output_t *output) {
+    fwrite(output->buffer, 1, output->used, stdout);
+    output->used = 0;
+}
+
+static void output_prime(uint64_t prime, void *context) {
+    output_t *output = context;
+    if (output->used > sizeof(output->buffer)-21) {
+        output_flush(output);
+    }
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = '0' + prime%10;
+        prime /= 10;
+    } while (prime > 0);
+    while (n > 0) {
+        output->buffer[output->used++] = digits[--n];
+    }
+    output->buffer[output->used++] = '\n';
+}
+
+static bool parse_u64(const char *text, uint64_t *value) {
+    char *notnumber_ptr;
+    *value = strtoull(text, &notnumber_ptr, 10);
+    return text[0] != '\0' && text[0] != '-' && *notnumber_ptr == '\0';
+}
+
+int main(int argc, char *argv[]) {
+    bool count_only = argc > 1 && strcmp(argv[1], "-c") == 0;
+    int first_arg = count_only ? 2 : 1;
+    uint64_t lo, hi;
+    if (argc != first_arg+2 || !parse_u64(argv[first_arg], &lo) || !parse_u64(argv[first_arg+1], &hi)) {
+        fprintf(stderr, "usage: find-primes-sieve [-c] <LO> <HI>\n"
+                        "finds all prime numbers in [LO, HI), or only counts them (-c)\n");
+        return EXIT_FAILURE;
+    }
+
+    if (count_only) {
+        printf("%" PRIu64 "\n", sieve_primes(lo, hi, NULL, NULL));
+        return EXIT_SUCCESS;
+    }
+
+    static output_t output;
+    uint64_t found = sieve_primes(lo, hi, output_prime, &output);
+    output_flush(&output);
+    fprintf(stderr, "primes: %" PRIu64 "\n", found);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,206 @@
+/* Faster prime number finder, parallel implementation with threads
+
+   The candidates are drawn in chunks, each from its own lanes of the bulk
+   generator: with 8 lanes, chunk k takes the subsequences of the seed jumped
+   from 8k to 8k+7 times. The threads claim the chunks in increasing order,
+   and post the primes of each chunk to a ring of their own; the main thread
+   collects the chunks from the rings in order. The output thus depends only
+   on the seed, never on the number of threads. */
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "primality.h"
+#include "pseudo-random.h"
+
+// Candidates per chunk: enough work to make claiming a chunk (a jump of the
+// generator per lane) negligible, small enough for all threads to stop soon
+// after the last prime is found
+#define Chunk_candidates 4096
+
+// Slots of each ring; a chunk is posted as its index, its count of primes,
+// and the primes, and even a chunk of only primes must fit
+#define Ring_slots 8192
+_Static_assert(Ring_slots >= Chunk_candidates+2, "ring too small for a chunk");
+
+/* --- Rings, with a single producer (a worker) and a single consumer (the
+       main thread) */
+
+typedef struct ring_t {
+    _Alignas(64) atomic_size_t head; // next slot to read
+    _Alignas(64) atomic_size_t tail; // next slot to write
+    _Alignas(64) uint64_t slots[Ring_slots];
+} ring_t;
+
+// Posts the primes of a chunk, waiting for room; gives up if stop is raised
+static bool ring_post(ring_t *ring, uint64_t chunk, const uint64_t *primes, size_t count,
+                      atomic_bool *stop) {
+    const size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    while (tail + count+2 - atomic_load_explicit(&ring->head, memory_order_acquire) > Ring_slots) {
+        if (atomic_load_explicit(stop, memory_order_relaxed)) {
+            return false;
+        }
+        sched_yield();
+    }
+    ring->slots[tail % Ring_slots] = chunk;
+    ring->slots[(tail+1) % Ring_slots] = count;
+    for (size_t i=0; i<count; i++) {
+        ring->slots[(tail+2+i) % Ring_slots] = primes[i];
+    }
+    atomic_store_explicit(&ring->tail, tail + count+2, memory_order_release);
+    return true;
+}
+
+// Tells if the next chunk posted to the ring is the given one
+static bool ring_holds(ring_t *ring, uint64_t chunk) {
+    const size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    return atomic_load_explicit(&ring->tail, memory_order_acquire) != head
+        && ring->slots[head % Ring_slots] == chunk;
+}
+
+/* --- Output, formatted by hand in a large buffer, written in blocks */
+
+typedef struct output_t {
+    char   buffer[1 << 16];
+    size_t used;
+} output_t;
+
+static void output_flush(output_t *output) {
+    fwrite(output->buffer, 1, output->used, stdout);
+    output->used = 0;
+}
+
+static void output_prime(output_t *output, uint64_t prime) {
+    if (output->used > sizeof(output->buffer)-21) {
+        output_flush(output);
+    }
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = '0' + prime%10;
+        prime /= 10;
+    } while (prime > 0);
+    while (n > 0) {
+        output->buffer[output->used++] = digits[--n];
+    }
+    output->buffer[output->used++] = '\n';
+}
+
+/* --- Search */
+
+typedef struct search_t {
+    pthread_mutex_t claim;
+    uint64_t        next_chunk;
+    pseudo_random_t next_random; // start of the subsequences of next_chunk
+    atomic_bool     stop;
+} search_t;
+
+typedef struct worker_t {
+    ring_t    ring;
+    search_t *search;
+    pthread_t thread;
+} worker_t;
+
+static void *worker_run(void *argument) {
+    worker_t *worker = argument;
+    search_t *search = worker->search;
+
+    while (!atomic_load_explicit(&search->stop, memory_order_relaxed)) {
+        // Claims the next chunk, and moves the shared state on to the one after
+        uint64_t chunk;
+        pseudo_random_lanes_t lanes;
+        pthread_mutex_lock(&search->claim);
+        chunk = search->next_chunk++;
+        pseudo_random_lanes_init_r(&lanes, &search->next_random);
+        pthread_mutex_unlock(&search->claim);
+
+        static _Thread_local uint64_t candidates[Chunk_candidates], primes[Chunk_candidates];
+        pseudo_random_lanes_fill(&lanes, candidates, Chunk_candidates);
+        size_t count = 0;
+        for (size_t b=0; b<Chunk_candidates; b+=Prefilter_batch) {
+            const unsigned survivors = prefilter_batch(candidates+b);
+            for (size_t i=0; i<Prefilter_batch; i++) {
+                if ((survivors >> i & 1) && miller_rabin(candidates[b+i])) {
+                    primes[count++] = candidates[b+i];
+                }
+            }
+        }
+        if (!ring_post(&worker->ring, chunk, primes, count, &search->stop)) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    long n = -1, t = -1;
+    if (argc > 2) {
+        char *notnumber_ptr;
+        n = strtol(argv[1], &notnumber_ptr, 10);
+        n = *notnumber_ptr == '\0' ? n : -1;
+        t = strtol(argv[2], &notnumber_ptr, 10);
+        t = *notnumber_ptr == '\0' ? t : -1;
+    }
+
+    if (n < 0 || t <= 0) {
+        fprintf(stderr, "usage: find-primes-threads <N> <T>\n"
+                        "finds N (large) prime numbers using T Threads\n");
+        return EXIT_FAILURE;
+    }
+
+    search_t search = { .claim = PTHREAD_MUTEX_INITIALIZER };
+    // pseudo_random_seed_r(&search.next_random, (uint64_t) clock()); // for varying results each time
+    pseudo_random_seed_r(&search.next_random, 1729); // for benchmarking with predictable results
+    atomic_init(&search.stop, false);
+
+    worker_t *workers = aligned_alloc(_Alignof(worker_t), t*sizeof(worker_t));
+    if (workers == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+    long started = 0;
+    for (; started<t; started++) {
+        workers[started].search = &search;
+        atomic_init(&workers[started].ring.head, 0);
+        atomic_init(&workers[started].ring.tail, 0);
+        if (pthread_create(&workers[started].thread, NULL, worker_run, &workers[started]) != 0) {
+            fprintf(stderr, "error creating threads\n");
+            break;
+        }
+    }
+
+    // Collects the chunks in order, from whichever thread got each of them
+    static output_t output;
+    long found = 0;
+    for (uint64_t chunk=0; found<n && started==t; chunk++) {
+        ring_t *ring = NULL;
+        while (ring == NULL) {
+            for (long i=0; i<t && ring==NULL; i++) {
+                ring = ring_holds(&workers[i].ring, chunk) ? &workers[i].ring : NULL;
+            }
+            if (ring == NULL) {
+                sched_yield();
+            }
+        }
+        const size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        const size_t count = ring->slots[(head+1) % Ring_slots];
+        for (size_t i=0; i<count && found<n; i++, found++) {
+            output_prime(&output, ring->slots[(head+2+i) % Ring_slots]);
+        }
+        atomic_store_explicit(&ring->head, head + count+2, memory_order_release);
+    }
+    output_flush(&output);
+
+    atomic_store(&search.stop, true);
+    for (long i=0; i<started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    free(workers);
+    return started == t ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,62 @@
+/* Prime number finder by trial division, skipping the multiples of the first
+   primes with a wheel; the wheel and its fastest kernel are generated on the
+   build machine (see create-test.c and bench-wheel.c) */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include <immintrin.h>
+
+#include "pseudo-random.h"
+
+#include "wheel.inc"
+#include "wheel-kernel.h"
+
+bool is_prime(const uint64_t candidate) {
+    if (candidate <= 1) {
+        return false;
+    }
+    // First, check if number is divisible by the primes of the wheel
+    for (size_t i=0; i<Wheel_primes_n; i++) {
+        if (candidate % Wheel_first_primes[i] == 0) return candidate == Wheel_first_primes[i];
+    }
+
+    // Then check all the other divisors the wheel leaves
+    const uint64_t max_divisor = (uint64_t) sqrtl(candidate);
+    return wheel_divisor(candidate, 2, max_divisor) == 0;
+}
+
+
+int main(int argc, char *argv[]) {
+    long n = -1;
+    if (argc > 1) {
+        char *notnumber_ptr;
+        n = strtol(argv[1], &notnumber_ptr, 10);
+        n = *notnumber_ptr == '\0' ? n : -1;
+    }
+
+    if (n < 0) {
+        fprintf(stderr, "usage: find-primes-wheel <N>\n"
+                        "finds N (large) prime numbers\n");
+        return EXIT_FAILURE;
+    }
+
+    // pseudo_random_seed((uint64_t) clock()); // for varying results each time
+    pseudo_random_seed(1729); // for benchmarking with predictable results
+
+    long found = 0;
+    while (found < n) {
+        uint64_t candidate = pseudo_random_next();
+        if (is_prime(candidate)) {
+            found++;
+            printf("%" PRIu64 "\n", candidate);
+            fflush(stdout);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,367 @@
+/* Primality tests for 64-bit numbers */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <immintrin.h>
+
+#include "primality.h"
+#include "pseudo-random.h"
+
+/* --- Prefilter: trial division by the first primes
+
+   An odd n is a multiple of the odd prime p iff n*inverse(p) <= (2^64-1)/p,
+   with the product taken modulo 2^64. The batch is screened in two stages:
+   first each lane holds a candidate, and all the candidates are tested
+   against the first few primes without a single branch; that discards most
+   of them, and each survivor is then tested alone, with a block of primes
+   in the lanes, until a factor is found. */
+
+// Inverses of the odd primes of first-primes.inc, generated by the Makefile
+// for the Prefilter_primes_N primes screened
+#include "first-inverses.inc"
+
+// Primes tested in the lanes of all candidates; the other primes are tested
+// in blocks of the same size
+#define Prefilter_first_N 8
+// Screening beyond the primes up to 313 stops paying off against Miller-Rabin
+#define Prefilter_primes_N 64
+
+_Static_assert(Prefilter_primes_N % Prefilter_first_N == 0, "blocks must be full");
+_Static_assert(Prefilter_primes_N == First_inverses_N, "first-inverses.inc must match the prefilter");
+_Static_assert(Prefilter_batch == 8, "kernels assume one candidate per AVX-512 lane");
+
+// Candidates up to the largest prime screened are left to Miller-Rabin, so
+// the primes screened are not rejected as multiples of themselves
+static unsigned prefilter_small(const uint64_t candidates[Prefilter_batch]) {
+    const uint64_t largest = First_odd_primes[Prefilter_primes_N-1];
+    unsigned small = 0;
+    for (unsigned i=0; i<Prefilter_batch; i++) {
+        small |= (unsigned) (candidates[i] <= largest) << i;
+    }
+    return small;
+}
+
+static unsigned prefilter_batch_scalar(const uint64_t candidates[Prefilter_batch]) {
+    unsigned survivors = 0;
+    for (unsigned i=0; i<Prefilter_batch; i++) {
+        const uint64_t n = candidates[i];
+        bool survivor = n % 2 != 0;
+        for (size_t k=0; k<Prefilter_first_N; k++) {
+            survivor &= n * First_inverses[k] > First_limits[k];
+        }
+        for (size_t k=Prefilter_first_N; survivor && k<Prefilter_primes_N; k++) {
+            survivor = n * First_inverses[k] > First_limits[k];
+        }
+        survivors |= (unsigned) survivor << i;
+    }
+    return survivors;
+}
+
+// There is no 64-bit multiplication in AVX2: it is assembled from three
+// 32x32-bit products, given the high halves of the operands
+__attribute__((target("avx2")))
+static inline __m256i multiply_avx2(__m256i a, __m256i a_high, __m256i b, __m256i b_high) {
+    const __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(a_high, b), _mm256_mul_epu32(a, b_high));
+    return _mm256_add_epi64(_mm256_mul_epu32(a, b), _mm256_slli_epi64(cross, 32));
+}
+
+// Unsigned a > b; AVX2 only compares signed numbers, so the sign bit of b
+// comes already flipped
+__attribute__((target("avx2")))
+static inline __m256i above_avx2(__m256i a, __m256i b_flipped) {
+    return _mm256_cmpgt_epi64(_mm256_xor_si256(a, _mm256_set1_epi64x(INT64_MIN)), b_flipped);
+}
+
+__attribute__((target("avx2")))
+static unsigned prefilter_batch_avx2(const uint64_t candidates[Prefilter_batch]) {
+    __m256i n[2], n_high[2], survivors[2];
+    for (int h=0; h<2; h++) {
+        n[h] = _mm256_loadu_si256((const __m256i *) candidates + h);
+        n_high[h] = _mm256_srli_epi64(n[h], 32);
+        // Only the sign bits matter: the lowest bit, for odd numbers, at first
+        survivors[h] = _mm256_slli_epi64(n[h], 63);
+    }
+    for (size_t k=0; k<Prefilter_first_N; k++) {
+        const __m256i inverse = _mm256_set1_epi64x(First_inverses[k]);
+        const __m256i inverse_high = _mm256_set1_epi64x(First_inverses[k] >> 32);
+        const __m256i limit = _mm256_set1_epi64x(First_limits[k] ^ INT64_MIN);
+        for (int h=0; h<2; h++) {
+            const __m256i product = multiply_avx2(n[h], n_high[h], inverse, inverse_high);
+            survivors[h] = _mm256_and_si256(survivors[h], above_avx2(product, limit));
+        }
+    }
+    unsigned result = (unsigned) _mm256_movemask_pd(_mm256_castsi256_pd(survivors[0]))
+                    | (unsigned) _mm256_movemask_pd(_mm256_castsi256_pd(survivors[1])) << 4;
+
+    for (unsigned left=result; left!=0; left&=left-1) {
+        const int i = __builtin_ctz(left);
+        const __m256i candidate = _mm256_set1_epi64x(candidates[i]);
+        const __m256i candidate_high = _mm256_set1_epi64x(candidates[i] >> 32);
+        for (size_t k=Prefilter_first_N; k<Prefilter_primes_N; k+=8) {
+            __m256i above = _mm256_set1_epi64x(-1);
+            for (int h=0; h<8; h+=4) {
+                const __m256i inverse = _mm256_loadu_si256((const __m256i *) (First_inverses+k+h));
+                const __m256i limit = _mm256_loadu_si256((const __m256i *) (First_limits+k+h));
+                const __m256i product = multiply_avx2(candidate, candidate_high,
+                                                      inverse, _mm256_srli_epi64(inverse, 32));
+                above = _mm256_and_si256(above,
+                            above_avx2(product, _mm256_xor_si256(limit, _mm256_set1_epi64x(INT64_MIN))));
+            }
+            if (_mm256_movemask_pd(_mm256_castsi256_pd(above)) != 0xF) {
+                result &= ~(1u << i);
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+__attribute__((target("avx512f,avx512dq")))
+static unsigned prefilter_batch_avx512(const uint64_t candidates[Prefilter_batch]) {
+    const __m512i n = _mm512_loadu_si512(candidates);
+    __mmask8 survivors = _mm512_test_epi64_mask(n, _mm512_set1_epi64(1));
+    for (size_t k=0; k<Prefilter_first_N; k++) {
+        const __m512i product = _mm512_mullo_epi64(n, _mm512_set1_epi64(First_inverses[k]));
+        survivors = _mm512_mask_cmpgt_epu64_mask(survivors, product, _mm512_set1_epi64(First_limits[k]));
+    }
+    unsigned result = survivors;
+
+    for (unsigned left=result; left!=0; left&=left-1) {
+        const int i = __builtin_ctz(left);
+        const __m512i candidate = _mm512_set1_epi64(candidates[i]);
+        for (size_t k=Prefilter_first_N; k<Prefilter_primes_N; k+=8) {
+            const __m512i product = _mm512_mullo_epi64(candidate, _mm512_loadu_si512(First_inverses+k));
+            if (_mm512_cmple_epu64_mask(product, _mm512_loadu_si512(First_limits+k)) != 0) {
+                result &= ~(1u << i);
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+static unsigned (*prefilter_kernel)(const uint64_t candidates[Prefilter_batch]);
+
+// Picks the kernel once, before main, so threads never race to set it
+__attribute__((constructor))
+static void prefilter_init(void) {
+    __builtin_cpu_init();
+    prefilter_kernel = __builtin_cpu_supports("avx512dq") ? prefilter_batch_avx512
+                     : __builtin_cpu_supports("avx2")     ? prefilter_batch_avx2
+                     :                                      prefilter_batch_scalar;
+}
+
+unsigned prefilter_batch(const uint64_t candidates[Prefilter_batch]) {
+    return prefilter_kernel(candidates) | prefilter_small(candidates);
+}
+
+/* --- Miller-Rabin */
+
+// No 64-bit composite is a strong pseudoprime to all of these bases
+static const uint64_t Bases[] = { 2, 325, 9375, 28178, 450775, 9780504, 1795265022 };
+static const size_t   Bases_N = sizeof(Bases) / sizeof(Bases[0]);
+
+/* --- Montgomery arithmetic, modulo an odd n, with R = 2^64 */
+
+typedef struct montgomery_t {
+    uint64_t n;
+    uint64_t n_inverse; // n * n_inverse == 1 (mod 2^64)
+    uint64_t r2;        // R^2 mod n, to convert into Montgomery form
+} montgomery_t;
+
+static void montgomery_init(montgomery_t *m, uint64_t n) {
+    // Newton's iteration doubles the correct low bits of the inverse at each
+    // step, starting from 3 bits (n*n == 1 mod 8 for any odd n)
+    uint64_t inverse = n;
+    for (int i=0; i<5; i++) {
+        inverse *= 2 - n*inverse;
+    }
+    const uint64_t r1 = -n % n;
+    m->n = n;
+    m->n_inverse = inverse;
+    m->r2 = (__uint128_t) r1 * r1 % n;
+}
+
+// Returns a*b/R mod n, for a, b < n
+static inline uint64_t montgomery_multiply(const montgomery_t *m, uint64_t a, uint64_t b) {
+    const __uint128_t product = (__uint128_t) a * b;
+    const uint64_t low = (uint64_t) product, high = (uint64_t) (product >> 64);
+    // Subtracting q*n, with q*n == product (mod R), leaves a multiple of R
+    const uint64_t q = low * m->n_inverse;
+    const uint64_t qn_high = (uint64_t) (((__uint128_t) q * m->n) >> 64);
+    return high >= qn_high ? high - qn_high : high - qn_high + m->n;
+}
+
+static inline uint64_t montgomery_from(const montgomery_t *m, uint64_t a) {
+    return montgomery_multiply(m, a % m->n, m->r2);
+}
+
+static uint64_t montgomery_power(const montgomery_t *m, uint64_t base, uint64_t exponent, uint64_t one) {
+    uint64_t result = one;
+    while (exponent > 0) {
+        if (exponent & 1) {
+            result = montgomery_multiply(m, result, base);
+        }
+        base = montgomery_multiply(m, base, base);
+        exponent >>= 1;
+    }
+    return result;
+}
+
+bool miller_rabin(uint64_t n) {
+    if (n < 4) {
+        return n >= 2;
+    }
+    if (n % 2 == 0) {
+        return false;
+    }
+
+    montgomery_t m;
+    montgomery_init(&m, n);
+    const uint64_t one = montgomery_from(&m, 1);
+    const uint64_t minus_one = n - one;
+
+    // n-1 == d * 2^s, with d odd
+    const int s = __builtin_ctzll(n-1);
+    const uint64_t d = (n-1) >> s;
+
+    for (size_t i=0; i<Bases_N; i++) {
+        const uint64_t base = montgomery_from(&m, Bases[i]);
+        if (base == 0) {
+            continue; // a base multiple of n proves nothing
+        }
+        uint64_t x = montgomery_power(&m, base, d, one);
+        if (x == one || x == minus_one) {
+            continue;
+        }
+        bool witness = true;
+        for (int r=1; r<s && witness; r++) {
+            x = montgomery_multiply(&m, x, x);
+            witness = x != minus_one;
+        }
+        if (witness) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* --- Factorization */
+
+// Steps of rho between the gcds, whose differences are multiplied together
+#define Rho_batch 128
+
+static uint64_t gcd(uint64_t a, uint64_t b) {
+    if (a == 0 || b == 0) {
+        return a | b;
+    }
+    const int shift = __builtin_ctzll(a | b);
+    a >>= __builtin_ctzll(a);
+    while (b != 0) {
+        b >>= __builtin_ctzll(b);
+        if (a > b) {
+            const uint64_t t = a;
+            a = b;
+            b = t;
+        }
+        b -= a;
+    }
+    return a << shift;
+}
+
+// x^2 + c, in Montgomery form
+static inline uint64_t rho_step(const montgomery_t *m, uint64_t x, uint64_t c) {
+    const uint64_t square = montgomery_multiply(m, x, x);
+    return square >= m->n - c ? square - (m->n - c) : square + c;
+}
+
+// Returns a factor of the odd composite n, other than 1 and n. The gcd of n
+// with a product of differences is the gcd with one of them, if the product
+// is not 0 mod n; the constants are in Montgomery form all along, which only
+// multiplies the differences by R, prime to n.
+static uint64_t pollard_brent(uint64_t n, pseudo_random_t *random) {
+    montgomery_t m;
+    montgomery_init(&m, n);
+    const uint64_t one = montgomery_from(&m, 1);
+    for (;;) {
+        const uint64_t c = pseudo_random_next_r(random) % (n-1) + 1;
+        uint64_t y = pseudo_random_next_r(random) % n, x = y, saved = y, product = one;
+        uint64_t g = 1;
+        for (uint64_t r=1; g==1; r*=2) {
+            x = y;
+            for (uint64_t i=0; i<r; i++) {
+                y = rho_step(&m, y, c);
+            }
+            for (uint64_t k=0; k<r && g==1; k+=Rho_batch) {
+                saved = y;
+                for (uint64_t i=0; i<Rho_batch && i<r-k; i++) {
+                    y = rho_step(&m, y, c);
+                    product = montgomery_multiply(&m, product, x > y ? x - y : y - x);
+                }
+                g = gcd(product, n);
+            }
+        }
+        if (g == n) {
+            // The product of the last batch reached 0: it is redone one step
+            // at a time, from its start
+            do {
+                saved = rho_step(&m, saved, c);
+                g = gcd(x > saved ? x - saved : saved - x, n);
+            } while (g == 1);
+        }
+        if (g != n) {
+            return g;
+        }
+        // x and y met modulo all factors at once: another c may split them
+    }
+}
+
+static void factorize_rho(uint64_t n, uint64_t factors[Factors_max], int *count,
+                          pseudo_random_t *random) {
+    if (miller_rabin(n)) {
+        factors[(*count)++] = n;
+        return;
+    }
+    const uint64_t d = pollard_brent(n, random);
+    factorize_rho(d, factors, count, random);
+    factorize_rho(n / d, factors, count, random);
+}
+
+int factorize(uint64_t n, uint64_t factors[Factors_max]) {
+    int count = 0;
+    if (n < 2) {
+        return 0;
+    }
+    for (; n % 2 == 0; n /= 2) {
+        factors[count++] = 2;
+    }
+    // For a multiple of p, n*inverse(p) is the exact quotient n/p
+    for (size_t k=0; k<Prefilter_primes_N && n > 1; k++) {
+        const uint64_t p = First_odd_primes[k];
+        if (p*p > n) {
+            factors[count++] = n;
+            return count;
+        }
+        for (; n * First_inverses[k] <= First_limits[k]; n *= First_inverses[k]) {
+            factors[count++] = p;
+        }
+    }
+    if (n > 1) {
+        // Seeded by n, so each number is always split the same way
+        pseudo_random_t random;
+        pseudo_random_seed_r(&random, n);
+        const int first = count;
+        factorize_rho(n, factors, &count, &random);
+        for (int i=first+1; i<count; i++) {
+            const uint64_t factor = factors[i];
+            int j = i;
+            for (; j>first && factors[j-1]>factor; j--) {
+                factors[j] = factors[j-1];
+            }
+            factors[j] = factor;
+        }
+    }
+    return count;
+}
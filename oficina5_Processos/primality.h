@@ -0,0 +1,42 @@
+/* Primality tests for 64-bit numbers
+
+   The candidates are first screened, in batches, by trial division by the
+   first primes. Each division is replaced by a multiplication with the
+   inverse of the prime modulo 2^64, and the whole batch is tested at once
+   in the AVX-512 or AVX2 lanes, when the processor has them.
+
+   The survivors go through a deterministic Miller-Rabin test. Its modular
+   arithmetic is done in Montgomery form, with 128-bit products, so no
+   division is needed inside the test. The seven bases found by Jim Sinclair
+   leave no strong pseudoprime below 2^64, so the answer is exact, not
+   probabilistic.
+
+   Composite numbers are factored by trial division by the same primes, and
+   then by Pollard's rho method, in Brent's variant, on the same Montgomery
+   arithmetic; each factor found is tested by Miller-Rabin, and split again
+   if it is composite. */
+
+#ifndef PRIMALITY_H
+#define PRIMALITY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Number of candidates screened by each call of prefilter_batch
+#define Prefilter_batch 8
+
+// Returns a mask with bit i set if candidates[i] may be prime, i.e., if it
+// has no small prime factor other than itself
+unsigned prefilter_batch(const uint64_t candidates[Prefilter_batch]);
+
+// Tells if n is prime; exact for all 64-bit numbers
+bool miller_rabin(uint64_t n);
+
+// A 64-bit number has at most 64 prime factors, counted with multiplicity
+#define Factors_max 64
+
+// Writes the prime factors of n, with multiplicity and in increasing order,
+// to factors; returns how many there are (none for n < 2)
+int factorize(uint64_t n, uint64_t factors[Factors_max]);
+
+#endif
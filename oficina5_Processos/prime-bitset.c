@@ -0,0 +1,284 @@
+/* Table of all primes below a limit, kept as a bitset in a file */
+
+#include "prime-bitset.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "prime-sieve.h"
+
+/* --- Layout */
+
+// Bit i stands for the number 30*(i/8) + Residues[i%8]
+static const uint8_t Residues[8] = { 1, 7, 11, 13, 17, 19, 23, 29 };
+
+// Residues below each number from 0 to 29
+static const uint8_t Below[30] = {
+    0, 0, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 4, 4, 4, 4, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7, 7, 7
+};
+
+#define Block_words 8
+#define Block_bits  (64*Block_words)
+
+static const char Magic[8] = "PRIMES30";
+
+typedef struct header_t {
+    char     magic[8];
+    uint64_t limit;
+    uint64_t primes_n;
+    uint64_t words_n;
+    uint64_t reserved[4];
+} header_t;
+_Static_assert(sizeof(header_t) == 64, "header must keep the words aligned");
+
+// Bits for the numbers below y, i.e., the bit of y if y is coprime to 30
+static inline uint64_t bits_below(uint64_t y) {
+    return y/30*8 + Below[y%30];
+}
+
+static inline uint64_t bit_value(uint64_t bit) {
+    return bit/8*30 + Residues[bit%8];
+}
+
+static uint64_t small_primes_below(uint64_t y) {
+    return (y > 2) + (y > 3) + (y > 5);
+}
+
+static size_t map_size(uint64_t words_n) {
+    return sizeof(header_t) + words_n*sizeof(uint64_t) + (words_n/Block_words + 1)*sizeof(uint64_t);
+}
+
+/* --- Creation */
+
+static void set_bit(uint64_t prime, void *context) {
+    uint64_t *words = context;
+    const uint64_t bit = bits_below(prime);
+    words[bit/64] |= (uint64_t) 1 << (bit%64);
+}
+
+bool prime_bitset_create(const char *path, uint64_t limit) {
+    const uint64_t blocks_n = (bits_below(limit) + Block_bits-1) / Block_bits;
+    const uint64_t words_n = blocks_n * Block_words;
+    const size_t size = map_size(words_n);
+
+    // Written aside, and renamed over path only when complete
+    char *temporary = malloc(strlen(path) + sizeof(".tmp"));
+    if (temporary == NULL) {
+        return false;
+    }
+    strcat(strcpy(temporary, path), ".tmp");
+    const int fd = open(temporary, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        free(temporary);
+        return false;
+    }
+    void *map = ftruncate(fd, size) == 0
+              ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (map == MAP_FAILED) {
+        close(fd);
+        remove(temporary);
+        free(temporary);
+        return false;
+    }
+
+    header_t *header = map;
+    uint64_t *words = (uint64_t *) (header+1);
+    uint64_t *ranks = words + words_n;
+    sieve_primes(limit < 7 ? limit : 7, limit, set_bit, words);
+    uint64_t count = small_primes_below(limit);
+    for (uint64_t b=0; b<blocks_n; b++) {
+        ranks[b] = count;
+        for (uint64_t w=b*Block_words; w<(b+1)*Block_words; w++) {
+            count += __builtin_popcountll(words[w]);
+        }
+    }
+    ranks[blocks_n] = count;
+
+    memcpy(header->magic, Magic, sizeof(Magic));
+    header->limit = limit;
+    header->primes_n = count;
+    header->words_n = words_n;
+
+    bool ok = msync(map, size, MS_SYNC) == 0;
+    ok = munmap(map, size) == 0 && ok;
+    ok = fsync(fd) == 0 && ok;
+    ok = close(fd) == 0 && ok;
+    ok = ok && rename(temporary, path) == 0;
+    if (!ok) {
+        remove(temporary);
+    }
+    free(temporary);
+    return ok;
+}
+
+/* --- Opening */
+
+bool prime_bitset_open(prime_bitset_t *bitset, const char *path) {
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat status;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &status) == 0 && (size_t) status.st_size >= sizeof(header_t)) {
+        map = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    const header_t *header = map;
+    if (memcmp(header->magic, Magic, sizeof(Magic)) != 0 || header->words_n % Block_words != 0
+            || map_size(header->words_n) != (size_t) status.st_size
+            || bits_below(header->limit) > header->words_n*64) {
+        munmap(map, status.st_size);
+        return false;
+    }
+    bitset->limit = header->limit;
+    bitset->primes_n = header->primes_n;
+    bitset->words_n = header->words_n;
+    bitset->words = (const uint64_t *) (header+1);
+    bitset->ranks = bitset->words + header->words_n;
+    bitset->map = map;
+    bitset->map_size = status.st_size;
+    return true;
+}
+
+void prime_bitset_close(prime_bitset_t *bitset) {
+    munmap(bitset->map, bitset->map_size);
+    bitset->map = NULL;
+}
+
+/* --- Queries */
+
+// Primes among the numbers of the bits below bit, and 2, 3 and 5
+static uint64_t rank(const prime_bitset_t *bitset, uint64_t bit) {
+    const uint64_t word = bit/64, first = word/Block_words*Block_words;
+    uint64_t count = bitset->ranks[word/Block_words];
+    for (uint64_t w=first; w<word; w++) {
+        count += __builtin_popcountll(bitset->words[w]);
+    }
+    if (bit%64 != 0) {
+        count += __builtin_popcountll(bitset->words[word] & (((uint64_t) 1 << (bit%64)) - 1));
+    }
+    return count;
+}
+
+bool prime_bitset_is_prime(const prime_bitset_t *bitset, uint64_t x) {
+    assert(x < bitset->limit);
+    if (x < 7) {
+        return x == 2 || x == 3 || x == 5;
+    }
+    if (bits_below(x+1) == bits_below(x)) {
+        return false; // not coprime to 30
+    }
+    const uint64_t bit = bits_below(x);
+    return bitset->words[bit/64] >> (bit%64) & 1;
+}
+
+uint64_t prime_bitset_pi(const prime_bitset_t *bitset, uint64_t x) {
+    assert(x < bitset->limit);
+    return x < 7 ? small_primes_below(x+1) : rank(bitset, bits_below(x+1));
+}
+
+uint64_t prime_bitset_next(const prime_bitset_t *bitset, uint64_t x) {
+    assert(x < bitset->limit);
+    if (x < 5) {
+        return x < 2 ? 2 : x < 3 ? 3 : 5;
+    }
+    const uint64_t bit = bits_below(x+1);
+    uint64_t word = bit/64;
+    uint64_t bits = word < bitset->words_n ? bitset->words[word] & (~(uint64_t) 0 << (bit%64)) : 0;
+    while (bits == 0 && ++word < bitset->words_n) {
+        bits = bitset->words[word];
+    }
+    // The bits from limit on are all 0
+    return bits == 0 ? 0 : bit_value(word*64 + __builtin_ctzll(bits));
+}
+
+uint64_t prime_bitset_prev(const prime_bitset_t *bitset, uint64_t x) {
+    assert(x <= bitset->limit);
+    const uint64_t bit = bits_below(x);
+    if (bit > 0) {
+        uint64_t word = (bit-1)/64;
+        uint64_t bits = bitset->words[word] & (~(uint64_t) 0 >> (63 - (bit-1)%64));
+        while (bits == 0 && word > 0) {
+            bits = bitset->words[--word];
+        }
+        if (bits != 0) {
+            return bit_value(word*64 + 63 - __builtin_clzll(bits));
+        }
+    }
+    return x > 5 ? 5 : x > 3 ? 3 : x > 2 ? 2 : 0;
+}
+
+uint64_t prime_bitset_each(const prime_bitset_t *bitset, uint64_t lo, uint64_t hi,
+                           prime_bitset_found_t found, void *context) {
+    assert(hi <= bitset->limit);
+    uint64_t count = 0;
+    for (uint64_t small=2; small<7 && small<hi; small+=small==2 ? 1 : 2) {
+        if (small >= lo) {
+            found(small, context);
+            count++;
+        }
+    }
+    if (hi <= 7) {
+        return count;
+    }
+    const uint64_t first = bits_below(lo > 7 ? lo : 7), last = bits_below(hi);
+    for (uint64_t word=first/64; word*64<last; word++) {
+        uint64_t bits = bitset->words[word];
+        if (word == first/64) {
+            bits &= ~(uint64_t) 0 << (first%64);
+        }
+        if ((word+1)*64 > last) {
+            bits &= ((uint64_t) 1 << (last%64)) - 1;
+        }
+        for (; bits!=0; bits&=bits-1) {
+            found(bit_value(word*64 + __builtin_ctzll(bits)), context);
+            count++;
+        }
+    }
+    return count;
+}
+
+/* --- Gaps */
+
+typedef struct gaps_context_t {
+    prime_gaps_t *gaps;
+    uint64_t      first, last;
+} gaps_context_t;
+
+static void add_gap(uint64_t prime, void *argument) {
+    gaps_context_t *context = argument;
+    prime_gaps_t *gaps = context->gaps;
+    if (gaps->primes++ == 0) {
+        context->first = prime;
+    }
+    else {
+        const uint64_t gap = prime - context->last;
+        gaps->gaps++;
+        gaps->histogram[gap < Prime_gaps_histogram ? gap : Prime_gaps_histogram]++;
+        if (gap > gaps->max) {
+            gaps->max = gap;
+            gaps->max_after = context->last;
+        }
+    }
+    context->last = prime;
+}
+
+void prime_bitset_gaps(const prime_bitset_t *bitset, uint64_t lo, uint64_t hi,
+                       prime_gaps_t *gaps) {
+    memset(gaps, 0, sizeof(*gaps));
+    gaps_context_t context = { gaps, 0, 0 };
+    prime_bitset_each(bitset, lo, hi, add_gap, &context);
+    gaps->mean = gaps->gaps == 0 ? 0 : (double) (context.last - context.first) / gaps->gaps;
+}
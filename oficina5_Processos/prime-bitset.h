@@ -0,0 +1,73 @@
+/* Table of all primes below a limit, kept as a bitset in a file
+
+   The numbers coprime to 30 are 8 in every 30 (residues 1, 7, 11, 13, 17,
+   19, 23 and 29), so each byte of the bitset covers 30 numbers, and the
+   table takes limit/30 bytes; 2, 3 and 5 are implied. Every block of 8
+   words (1920 numbers) starts with the count of the primes before it, so
+   pi(x) takes at most 8 popcounts. The file is mapped into memory as it
+   is, in the byte order of the machine that created it. */
+
+#ifndef PRIME_BITSET_H
+#define PRIME_BITSET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct prime_bitset_t {
+    uint64_t        limit;    // the table covers [0, limit)
+    uint64_t        primes_n; // primes below limit
+    uint64_t        words_n;
+    const uint64_t *words;
+    const uint64_t *ranks;    // primes below each block, 2, 3 and 5 included
+    void           *map;
+    size_t          map_size;
+} prime_bitset_t;
+
+// Sieves the primes below limit into a new file at path (replacing it
+// atomically, if it exists); returns false on errors
+bool prime_bitset_create(const char *path, uint64_t limit);
+
+// Maps the file at path; returns false on errors, or if it is not a table
+bool prime_bitset_open(prime_bitset_t *bitset, const char *path);
+
+void prime_bitset_close(prime_bitset_t *bitset);
+
+// The queries below need x < limit
+
+bool prime_bitset_is_prime(const prime_bitset_t *bitset, uint64_t x);
+
+// Number of primes <= x
+uint64_t prime_bitset_pi(const prime_bitset_t *bitset, uint64_t x);
+
+// Smallest prime > x, or 0 if there is none below limit
+uint64_t prime_bitset_next(const prime_bitset_t *bitset, uint64_t x);
+
+// Largest prime < x, or 0 if there is none
+uint64_t prime_bitset_prev(const prime_bitset_t *bitset, uint64_t x);
+
+// Calls found for each prime in [lo, hi), hi <= limit, in increasing order;
+// returns how many were found
+typedef void (*prime_bitset_found_t)(uint64_t prime, void *context);
+uint64_t prime_bitset_each(const prime_bitset_t *bitset, uint64_t lo, uint64_t hi,
+                           prime_bitset_found_t found, void *context);
+
+/* --- Gaps between consecutive primes */
+
+// Gaps up to this are counted one by one, the larger in the last entry
+#define Prime_gaps_histogram 128
+
+typedef struct prime_gaps_t {
+    uint64_t primes;    // in the range
+    uint64_t gaps;      // between consecutive primes in the range
+    uint64_t max;       // largest gap...
+    uint64_t max_after; // ...and the prime before it
+    double   mean;
+    uint64_t histogram[Prime_gaps_histogram+1]; // gaps of each size
+} prime_gaps_t;
+
+// Statistics of the gaps between the primes in [lo, hi), hi <= limit
+void prime_bitset_gaps(const prime_bitset_t *bitset, uint64_t lo, uint64_t hi,
+                       prime_gaps_t *gaps);
+
+#endif
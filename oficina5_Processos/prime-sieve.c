@@ -0,0 +1,425 @@
+/* Segmented sieve of Eratosthenes for ranges of 64-bit numbers */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "prime-sieve.h"
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "the wheel pattern is copied by bytes, but the segments are read by 64-bit words"
+#endif
+
+// The odd number 2*i+1 has odd index i; bit i of a segment stands for the
+// odd index first+i, where first (a multiple of 64) starts the segment
+
+static void *check_alloc(void *pointer) {
+    if (pointer == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return pointer;
+}
+
+/* --- Wheel: the same residues modulo primorial(5) that create-test.c keeps */
+
+static const uint64_t Wheel_primes[] = { 2, 3, 5, 7, 11 };
+#define Wheel_primes_n 5
+#define Wheel_odds     1155  // odd numbers in primorial(5)==2310
+
+// Bit b is set if the odd index b is not a multiple of 3, 5, 7 or 11. The
+// period is Wheel_odds bits, so Wheel_odds bytes hold 8 whole periods, and
+// copying them from byte (first/8) % Wheel_odds on matches a segment; the
+// pattern is repeated so that copies need not wrap around
+static uint8_t wheel_pattern[2*Wheel_odds];
+
+/* --- Multiples crossed off: only p*m with m coprime to the modulus of a
+       wheel, the others being multiples of the wheel primes, removed by
+       the pattern. Primes smaller than a segment use the mod 30 wheel,
+       whose 8 steps are unrolled; larger primes use primorial(5), with
+       fewer multiples. */
+
+typedef struct wheel_t {
+    uint32_t  modulus;
+    size_t    residues_n;
+    uint32_t *residues;
+    uint8_t  *half_steps;    // from each residue to the next, in odd indexes
+    uint16_t *next_residue;  // index of the first residue >= r, or residues_n
+    uint8_t   max_half_step;
+} wheel_t;
+
+static uint32_t wheel_30_residues[8], wheel_2310_residues[480];
+static uint8_t  wheel_30_half_steps[8], wheel_2310_half_steps[480];
+static uint16_t wheel_30_next_residue[30], wheel_2310_next_residue[2310];
+
+static wheel_t wheel_30 = {
+    30, 8, wheel_30_residues, wheel_30_half_steps, wheel_30_next_residue, 0
+};
+static wheel_t wheel_2310 = {
+    2310, 480, wheel_2310_residues, wheel_2310_half_steps, wheel_2310_next_residue, 0
+};
+
+static void wheel_residues_init(wheel_t *wheel) {
+    size_t n = 0;
+    for (uint32_t r=0; r<wheel->modulus; r++) {
+        bool keep = true;
+        for (size_t i=0; keep && i<Wheel_primes_n; i++) keep = wheel->modulus % Wheel_primes[i] != 0 || r % Wheel_primes[i] != 0;
+        if (keep) wheel->residues[n++] = r;
+    }
+    n = 0;
+    for (uint32_t r=0; r<wheel->modulus; r++) {
+        while (n < wheel->residues_n && wheel->residues[n] < r) n++;
+        wheel->next_residue[r] = n;
+    }
+    for (size_t i=0; i<wheel->residues_n; i++) {
+        const uint32_t next = i+1 < wheel->residues_n ? wheel->residues[i+1] : wheel->residues[0] + wheel->modulus;
+        wheel->half_steps[i] = (next - wheel->residues[i]) / 2;
+        if (wheel->half_steps[i] > wheel->max_half_step) wheel->max_half_step = wheel->half_steps[i];
+    }
+}
+
+// Finds the odd index of the first multiple p*m >= start, with m in the
+// wheel, and the position of m in the wheel; returns false if it is not
+// below the odd index hi_index
+static bool first_multiple(const wheel_t *wheel, uint64_t p, uint64_t start, uint64_t hi_index,
+                           uint64_t *index, uint16_t *position) {
+    uint64_t multiplier = start/p + (start%p != 0);
+    const uint32_t residue = multiplier % wheel->modulus;
+    *position = wheel->next_residue[residue];
+    multiplier -= residue;
+    if (*position == wheel->residues_n) {
+        multiplier += wheel->modulus;
+        *position = 0;
+    }
+    multiplier += wheel->residues[*position];
+    if (multiplier > (2*hi_index) / p) {
+        return false;
+    }
+    *index = (p*multiplier) / 2;
+    return *index < hi_index;
+}
+
+static void wheel_init(void) {
+    static bool initialized = false;
+    if (initialized) {
+        return;
+    }
+    for (size_t bit=0; bit<8*Wheel_odds; bit++) {
+        const uint64_t odd = 2*bit+1;
+        bool keep = true;
+        for (size_t i=1; keep && i<Wheel_primes_n; i++) keep = odd % Wheel_primes[i] != 0;
+        if (keep) {
+            wheel_pattern[bit/8] |= 1 << (bit%8);
+        }
+    }
+    memcpy(wheel_pattern+Wheel_odds, wheel_pattern, Wheel_odds);
+    wheel_residues_init(&wheel_30);
+    wheel_residues_init(&wheel_2310);
+    initialized = true;
+}
+
+static void wheel_copy(uint8_t *segment, size_t bytes, uint64_t first) {
+    const size_t start = (first/8) % Wheel_odds;
+    for (size_t done=0; done<bytes; done+=Wheel_odds) {
+        const size_t n = bytes-done < Wheel_odds ? bytes-done : Wheel_odds;
+        memcpy(segment+done, wheel_pattern+start, n);
+    }
+}
+
+/* --- Sieving primes, from 13 on
+
+   Primes smaller than a segment cross off bits in every segment, and keep
+   the odd index of their next multiple. Larger primes cross off at most once
+   per segment, so they wait in a bucket for the segment of their next
+   multiple, and are not even looked at in the segments they skip. The ring
+   of buckets reaches as far as the longest step of a prime, but no further
+   than the range nor than Max_buckets segments, which tiny segments far up
+   would need; the primes whose next multiple lies beyond it wait in a heap,
+   by segment, until the ring gets there. */
+
+typedef struct bucket_entry_t {
+    uint32_t prime;
+    uint32_t offset;    // in the segment of the bucket
+    uint16_t position;  // of the multiplier, in the primorial(5) wheel
+} bucket_entry_t;
+
+typedef struct bucket_t {
+    bucket_entry_t *entries;
+    size_t          n, max;
+} bucket_t;
+
+typedef struct pending_t {
+    uint64_t       segment;
+    bucket_entry_t entry;
+} pending_t;
+
+static const size_t Max_buckets = 1 << 16;
+
+typedef struct sieve_t {
+    uint64_t  first, hi_index;  // odd indexes of the range, first aligned to 64
+    uint64_t  segment_bits;
+    uint64_t  lo;
+    // Small primes
+    uint32_t *primes;
+    uint8_t  *positions;
+    uint64_t *next;
+    size_t    primes_n, primes_max;
+    // Large primes, in a ring of buckets for the next segments
+    bucket_t *buckets;
+    size_t    buckets_n;
+    // ...and beyond the ring, in a binary heap with the nearest segment on top
+    pending_t *pending;
+    size_t     pending_n, pending_max;
+} sieve_t;
+
+static void bucket_add(bucket_t *bucket, uint32_t prime, uint32_t offset, uint16_t position) {
+    if (bucket->n == bucket->max) {
+        bucket->max = bucket->max ? 2*bucket->max : 64;
+        bucket->entries = check_alloc(realloc(bucket->entries, bucket->max*sizeof(bucket_entry_t)));
+    }
+    bucket->entries[bucket->n++] = (bucket_entry_t) { prime, offset, position };
+}
+
+static void pending_push(sieve_t *sieve, uint64_t segment, bucket_entry_t entry) {
+    if (sieve->pending_n == sieve->pending_max) {
+        sieve->pending_max = sieve->pending_max ? 2*sieve->pending_max : 1024;
+        sieve->pending = check_alloc(realloc(sieve->pending, sieve->pending_max*sizeof(pending_t)));
+    }
+    size_t i = sieve->pending_n++;
+    for (; i > 0 && sieve->pending[(i-1)/2].segment > segment; i = (i-1)/2) {
+        sieve->pending[i] = sieve->pending[(i-1)/2];
+    }
+    sieve->pending[i] = (pending_t) { segment, entry };
+}
+
+static pending_t pending_pop(sieve_t *sieve) {
+    const pending_t top = sieve->pending[0];
+    const pending_t last = sieve->pending[--sieve->pending_n];
+    size_t i = 0;
+    for (size_t child; (child = 2*i+1) < sieve->pending_n; i = child) {
+        if (child+1 < sieve->pending_n && sieve->pending[child+1].segment < sieve->pending[child].segment) {
+            child++;
+        }
+        if (sieve->pending[child].segment >= last.segment) {
+            break;
+        }
+        sieve->pending[i] = sieve->pending[child];
+    }
+    sieve->pending[i] = last;
+    return top;
+}
+
+// Adds the sieving prime p, from its first multiple in the range, if any
+static void sieve_add_prime(uint64_t p, void *context) {
+    sieve_t *sieve = context;
+    const uint64_t start = p*p > sieve->lo ? p*p : sieve->lo;
+    uint64_t index;
+    uint16_t position;
+    if (p < sieve->segment_bits) {
+        if (!first_multiple(&wheel_30, p, start, sieve->hi_index, &index, &position)) {
+            return;
+        }
+        if (sieve->primes_n == sieve->primes_max) {
+            sieve->primes_max = sieve->primes_max ? 2*sieve->primes_max : 1024;
+            sieve->primes = check_alloc(realloc(sieve->primes, sieve->primes_max*sizeof(uint32_t)));
+            sieve->positions = check_alloc(realloc(sieve->positions, sieve->primes_max*sizeof(uint8_t)));
+            sieve->next = check_alloc(realloc(sieve->next, sieve->primes_max*sizeof(uint64_t)));
+        }
+        sieve->primes[sieve->primes_n] = p;
+        sieve->positions[sieve->primes_n] = position;
+        sieve->next[sieve->primes_n++] = index;
+    }
+    else if (first_multiple(&wheel_2310, p, start, sieve->hi_index, &index, &position)) {
+        const uint64_t segment = (index - sieve->first) / sieve->segment_bits;
+        const uint32_t offset = (index - sieve->first) % sieve->segment_bits;
+        if (segment < sieve->buckets_n) {
+            bucket_add(&sieve->buckets[segment], p, offset, position);
+        }
+        else {
+            pending_push(sieve, segment, (bucket_entry_t) { p, offset, position });
+        }
+    }
+}
+
+// Limit up to which the sieving primes are found by a plain sieve
+static const uint64_t Plain_sieve_limit = 1 << 16;
+
+static void sieving_primes(uint64_t limit, sieve_found_t found, void *context) {
+    if (limit >= Plain_sieve_limit) {
+        // Needs the primes up to the fourth root of hi
+        sieve_primes(13, limit+1, found, context);
+        return;
+    }
+    bool *composite = check_alloc(calloc(limit+1, sizeof(bool)));
+    for (uint64_t i=3; i*i<=limit; i+=2) {
+        if (!composite[i]) {
+            for (uint64_t j=i*i; j<=limit; j+=2*i) composite[j] = true;
+        }
+    }
+    for (uint64_t i=13; i<=limit; i+=2) {
+        if (!composite[i]) found(i, context);
+    }
+    free(composite);
+}
+
+static uint64_t isqrt(uint64_t n) {
+    uint64_t root = 0;
+    for (uint64_t bit=UINT64_C(1)<<31; bit>0; bit>>=1) {
+        const uint64_t candidate = root | bit;
+        if (candidate*candidate <= n) root = candidate;
+    }
+    return root;
+}
+
+/* --- Segments */
+
+static size_t segment_size = 0;
+
+void sieve_set_segment_size(size_t bytes) {
+    segment_size = bytes;
+}
+
+static size_t segment_bytes(void) {
+    size_t bytes = segment_size;
+    if (bytes == 0) {
+        // The small primes are crossed faster with segments that outgrow the L1
+        // cache: best measured around 1/8 of the L2 cache
+        long l2_size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+        bytes = l2_size > 0 ? l2_size/8 : 256*1024;
+    }
+    return (bytes+7) / 8 * 8;
+}
+
+static inline void clear_bit(uint64_t *segment, uint64_t bit) {
+    segment[bit/64] &= ~(UINT64_C(1) << (bit%64));
+}
+
+uint64_t sieve_primes(uint64_t lo, uint64_t hi, sieve_found_t found, void *context) {
+    wheel_init();
+    uint64_t count = 0;
+    // The primes of the wheel are removed with their multiples, so they are
+    // reported apart; the sieve itself starts from 13
+    for (size_t i=0; i<Wheel_primes_n; i++) {
+        if (lo <= Wheel_primes[i] && Wheel_primes[i] < hi) {
+            count++;
+            if (found != NULL) found(Wheel_primes[i], context);
+        }
+    }
+    lo = lo > 13 ? lo : 13;
+    if (lo >= hi) {
+        return count;
+    }
+
+    const size_t bytes = segment_bytes();
+    const uint64_t lo_index = lo/2;
+    const uint64_t limit = isqrt(hi-1);
+    sieve_t sieve = {
+        .first        = lo_index/64*64,
+        .hi_index     = hi/2,
+        .segment_bits = 8*bytes,
+        .lo           = lo,
+    };
+    // Enough for the longest step of a large prime, when that is affordable
+    const uint64_t longest_step = wheel_2310.max_half_step*limit/sieve.segment_bits + 2;
+    const uint64_t segments_n = (sieve.hi_index - sieve.first + sieve.segment_bits-1) / sieve.segment_bits;
+    sieve.buckets_n = longest_step < segments_n ? longest_step : segments_n;
+    sieve.buckets_n = sieve.buckets_n < Max_buckets ? sieve.buckets_n : Max_buckets;
+    sieve.buckets = check_alloc(calloc(sieve.buckets_n, sizeof(bucket_t)));
+    sieving_primes(limit, sieve_add_prime, &sieve);
+
+    uint64_t *segment = check_alloc(malloc(bytes));
+    for (uint64_t first=sieve.first, n=0; first<sieve.hi_index; first+=sieve.segment_bits, n++) {
+        const uint64_t bits = sieve.hi_index-first < sieve.segment_bits ? sieve.hi_index-first : sieve.segment_bits;
+        const size_t words = (bits+63) / 64;
+        wheel_copy((uint8_t *) segment, 8*words, first);
+
+        // The ring now reaches the segments up to n+buckets_n-1
+        while (sieve.pending_n > 0 && sieve.pending[0].segment < n + sieve.buckets_n) {
+            const pending_t pending = pending_pop(&sieve);
+            bucket_add(&sieve.buckets[pending.segment % sieve.buckets_n], pending.entry.prime,
+                       pending.entry.offset, pending.entry.position);
+        }
+
+        for (size_t i=0; i<sieve.primes_n; i++) {
+            const uint64_t p = sieve.primes[i];
+            uint64_t offset = sieve.next[i] - first;
+            unsigned position = sieve.positions[i];
+            // One multiple at a time up to the start of a turn of the wheel,
+            // then whole turns while they fit, then the rest of the segment
+            for (; position != 0 && offset < bits; position = (position+1) % 8) {
+                clear_bit(segment, offset);
+                offset += p*wheel_30_half_steps[position];
+            }
+            if (position == 0) {
+                for (; offset+14*p < bits; offset+=15*p) {
+                    clear_bit(segment, offset);
+                    clear_bit(segment, offset+3*p);
+                    clear_bit(segment, offset+5*p);
+                    clear_bit(segment, offset+6*p);
+                    clear_bit(segment, offset+8*p);
+                    clear_bit(segment, offset+9*p);
+                    clear_bit(segment, offset+11*p);
+                    clear_bit(segment, offset+14*p);
+                }
+                for (; offset < bits; position = (position+1) % 8) {
+                    clear_bit(segment, offset);
+                    offset += p*wheel_30_half_steps[position];
+                }
+            }
+            sieve.next[i] = first + offset;
+            sieve.positions[i] = position;
+        }
+
+        bucket_t *bucket = &sieve.buckets[n % sieve.buckets_n];
+        for (size_t i=0; i<bucket->n; i++) {
+            bucket_entry_t entry = bucket->entries[i];
+            clear_bit(segment, entry.offset);
+            uint64_t offset = entry.offset + (uint64_t) entry.prime*wheel_2310_half_steps[entry.position];
+            uint16_t position = entry.position+1 < wheel_2310.residues_n ? entry.position+1 : 0;
+            if (first + offset >= sieve.hi_index) {
+                continue;
+            }
+            const uint64_t ahead = offset/sieve.segment_bits;
+            if (ahead < sieve.buckets_n) {
+                bucket_add(&sieve.buckets[(n + ahead) % sieve.buckets_n],
+                           entry.prime, offset % sieve.segment_bits, position);
+            }
+            else {
+                pending_push(&sieve, n + ahead, (bucket_entry_t) { entry.prime, offset % sieve.segment_bits, position });
+            }
+        }
+        bucket->n = 0;
+
+        // Bits outside [lo, hi) at the ends of the range
+        if (first < lo_index) {
+            segment[0] &= ~UINT64_C(0) << (lo_index-first);
+        }
+        if (bits%64 != 0) {
+            segment[words-1] &= ~(~UINT64_C(0) << (bits%64));
+        }
+
+        for (size_t w=0; w<words; w++) {
+            if (found == NULL) {
+                count += __builtin_popcountll(segment[w]);
+                continue;
+            }
+            for (uint64_t word=segment[w]; word!=0; word&=word-1) {
+                count++;
+                found(2*(first + 64*w + __builtin_ctzll(word)) + 1, context);
+            }
+        }
+    }
+
+    free(segment);
+    for (size_t i=0; i<sieve.buckets_n; i++) {
+        free(sieve.buckets[i].entries);
+    }
+    free(sieve.buckets);
+    free(sieve.pending);
+    free(sieve.primes);
+    free(sieve.positions);
+    free(sieve.next);
+    return count;
+}
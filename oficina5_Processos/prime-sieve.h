@@ -0,0 +1,26 @@
+/* Segmented sieve of Eratosthenes for ranges of 64-bit numbers
+
+   Each segment is a bitset of the odd numbers, sized to stay in the cache.
+   The multiples of 3, 5, 7 and 11 are removed by copying a precomputed
+   pattern of the 2*3*5*7*11 wheel, so only the primes from 13 on are
+   sieved one by one. The primes larger than a segment hit it at most once,
+   so they wait in buckets for the segment of their next multiple. */
+
+#ifndef PRIME_SIEVE_H
+#define PRIME_SIEVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Called for each prime found, in increasing order
+typedef void (*sieve_found_t)(uint64_t prime, void *context);
+
+// Finds the primes in [lo, hi), calling found (if not NULL) for each of
+// them; returns how many were found
+uint64_t sieve_primes(uint64_t lo, uint64_t hi, sieve_found_t found, void *context);
+
+// Size, in bytes, of the segments; 0 (the default) uses 1/8 of the L2
+// cache of the machine
+void sieve_set_segment_size(size_t bytes);
+
+#endif
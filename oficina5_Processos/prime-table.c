@@ -0,0 +1,142 @@
+/* Creates and queries tables of all primes below a limit (prime-bitset.h)
+
+   Besides answering queries, the table generates first-primes.inc (see the
+   Makefile), in the narrowest type that holds its primes. */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "prime-bitset.h"
+
+static bool parse_u64(const char *text, uint64_t *value) {
+    char *notnumber_ptr;
+    *value = strtoull(text, &notnumber_ptr, 10);
+    return text[0] != '\0' && text[0] != '-' && *notnumber_ptr == '\0';
+}
+
+static void print_prime(uint64_t prime, void *context) {
+    printf("%" PRIu64 "\n", prime);
+}
+
+typedef struct first_primes_t {
+    uint64_t n, printed, last;
+} first_primes_t;
+
+static void find_last_prime(uint64_t prime, void *context) {
+    first_primes_t *first = context;
+    if (first->printed < first->n) {
+        first->printed++;
+        first->last = prime;
+    }
+}
+
+// Formats as the table of first-primes.inc, 10 to a line
+static void print_first_prime(uint64_t prime, void *context) {
+    first_primes_t *first = context;
+    if (first->printed == first->n) {
+        return;
+    }
+    printf(first->printed%10 == 0 ? "    %5" PRIu64 : " %5" PRIu64, prime);
+    first->printed++;
+    printf(first->printed == first->n ? "\n" : first->printed%10 == 0 ? ",\n" : ",");
+}
+
+static void print_gaps(const prime_gaps_t *gaps) {
+    printf("primes: %" PRIu64 "\n", gaps->primes);
+    printf("gaps: %" PRIu64 "\n", gaps->gaps);
+    printf("mean gap: %.4f\n", gaps->mean);
+    printf("largest gap: %" PRIu64 ", after %" PRIu64 "\n", gaps->max, gaps->max_after);
+    printf("gap count\n");
+    for (int gap=1; gap<=Prime_gaps_histogram; gap++) {
+        if (gaps->histogram[gap] != 0) {
+            printf(gap < Prime_gaps_histogram ? "%3d %" PRIu64 "\n" : ">=%d %" PRIu64 "\n",
+                   gap, gaps->histogram[gap]);
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *command = argc > 1 ? argv[1] : "";
+    const char *path = argc > 2 ? argv[2] : "";
+    uint64_t a = 0, b = 0;
+    const bool ranged = strcmp(command, "gaps") == 0 || strcmp(command, "list") == 0;
+    const bool known = ranged || strcmp(command, "create") == 0 || strcmp(command, "pi") == 0
+                    || strcmp(command, "next") == 0 || strcmp(command, "prev") == 0
+                    || strcmp(command, "first-primes") == 0;
+    if (!known || argc != 4+ranged || !parse_u64(argv[3], &a) || (ranged && !parse_u64(argv[4], &b))) {
+        fprintf(stderr, "usage: prime-table create <FILE> <LIMIT>\n"
+                        "       prime-table pi|next|prev <FILE> <X>\n"
+                        "       prime-table list|gaps <FILE> <LO> <HI>\n"
+                        "       prime-table first-primes <FILE> <N>\n"
+                        "creates a table of the primes below LIMIT, or answers from it:\n"
+                        "the number of primes <= X, the prime after or before X, the primes\n"
+                        "in [LO, HI) or the gaps between them; first-primes writes the first N\n"
+                        "primes as first-primes.inc\n");
+        return EXIT_FAILURE;
+    }
+
+    if (strcmp(command, "create") == 0) {
+        if (!prime_bitset_create(path, a)) {
+            fprintf(stderr, "cannot create %s\n", path);
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    prime_bitset_t bitset;
+    if (!prime_bitset_open(&bitset, path)) {
+        fprintf(stderr, "cannot open %s, or it is not a table of primes\n", path);
+        return EXIT_FAILURE;
+    }
+    const uint64_t limit = bitset.limit;
+    bool ok = true;
+    if (strcmp(command, "first-primes") == 0) {
+        first_primes_t first = { a, 0, 0 };
+        ok = a > 0 && a <= bitset.primes_n;
+        if (ok) {
+            prime_bitset_each(&bitset, 0, limit, find_last_prime, &first);
+            const int bits = first.last <= UINT16_MAX ? 16 : first.last <= UINT32_MAX ? 32 : 64;
+            first.printed = 0;
+            printf("// [[ ---------- code generated by prime-table.c\n");
+            printf("#define First_primes_N %" PRIu64 "\n", a);
+            printf("#define First_primes_max %" PRIu64 "\n", first.last);
+            printf("static const uint%d_t First_primes[First_primes_N] = {\n", bits);
+            prime_bitset_each(&bitset, 0, limit, print_first_prime, &first);
+            printf("};\n");
+            printf("_Static_assert(First_primes_max <= UINT%d_MAX, \"primes must fit their type\");\n",
+                   bits);
+            printf("// ---------- ]]\n");
+        }
+    }
+    else if (ranged) {
+        ok = a <= b && b <= limit;
+        if (ok && strcmp(command, "list") == 0) {
+            prime_bitset_each(&bitset, a, b, print_prime, NULL);
+        }
+        else if (ok) {
+            prime_gaps_t gaps;
+            prime_bitset_gaps(&bitset, a, b, &gaps);
+            print_gaps(&gaps);
+        }
+    }
+    else if (strcmp(command, "prev") == 0) {
+        ok = a <= limit;
+        if (ok) printf("%" PRIu64 "\n", prime_bitset_prev(&bitset, a));
+    }
+    else {
+        ok = a < limit;
+        if (ok && strcmp(command, "pi") == 0) printf("%" PRIu64 "\n", prime_bitset_pi(&bitset, a));
+        if (ok && strcmp(command, "next") == 0) printf("%" PRIu64 "\n", prime_bitset_next(&bitset, a));
+    }
+    prime_bitset_close(&bitset);
+
+    if (!ok) {
+        fprintf(stderr, "out of the table: it has %" PRIu64 " primes, below %" PRIu64 "\n",
+                bitset.primes_n, limit);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -3,6 +3,9 @@
    splitmix64.c the latter being used to seed the former. This basically just
    adds header guards and friendlier/safer names to their code. */
 
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "pseudo-random.h"
@@ -16,36 +19,61 @@
 
    The state must be seeded so that it is not everywhere zero. If you have
    a 64-bit seed, we suggest to seed a splitmix64 generator and use its
-   output to fill pseudo_random_state. */
-
-uint64_t pseudo_random_state[4];
+   output to fill the state. */
+
+// The default state, for the functions without an explicit one; each thread
+// has its own, so threads can draw from separate streams
+static _Thread_local pseudo_random_t pseudo_random_default;
+static _Thread_local bool pseudo_random_default_seeded = false;
+
+// Seeds of the default states that threads use before seeding them, one
+// after the other: an all-zero state would only ever return zeros
+static const uint64_t Pseudo_random_default_seed = 1729;
+static atomic_uint_fast64_t pseudo_random_default_threads = 0;
+
+void pseudo_random_seed_r(pseudo_random_t *random, uint64_t seed);
+
+static pseudo_random_t *pseudo_random_default_state(void) {
+    if (!pseudo_random_default_seeded) {
+        pseudo_random_seed_r(&pseudo_random_default,
+                             Pseudo_random_default_seed + atomic_fetch_add(&pseudo_random_default_threads, 1));
+        pseudo_random_default_seeded = true;
+    }
+    return &pseudo_random_default;
+}
 
 static inline uint64_t pseudo_random_rotl(const uint64_t x, int k) {
     return (x << k) | (x >> (64 - k));
 }
 
-uint64_t pseudo_random_next(void) {
-    const uint64_t result = pseudo_random_rotl(pseudo_random_state[1]*5, 7) * 9;
+uint64_t pseudo_random_next_r(pseudo_random_t *random) {
+    uint64_t *s = random->state;
+    const uint64_t result = pseudo_random_rotl(s[1]*5, 7) * 9;
 
-    const uint64_t t = pseudo_random_state[1] << 17;
+    const uint64_t t = s[1] << 17;
 
-    pseudo_random_state[2] ^= pseudo_random_state[0];
-    pseudo_random_state[3] ^= pseudo_random_state[1];
-    pseudo_random_state[1] ^= pseudo_random_state[2];
-    pseudo_random_state[0] ^= pseudo_random_state[3];
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
 
-    pseudo_random_state[2] ^= t;
+    s[2] ^= t;
 
-    pseudo_random_state[3] = pseudo_random_rotl(pseudo_random_state[3], 45);
+    s[3] = pseudo_random_rotl(s[3], 45);
 
     return result;
 }
 
+uint64_t pseudo_random_next(void) {
+    return pseudo_random_next_r(pseudo_random_default_state());
+}
+
 /* This is the jump function for the generator. It is equivalent
    to 2^128 calls to pseudo_random_next(); it can be used to generate 2^128
    non-overlapping subsequences for parallel computations. */
 
-void pseudo_random_jump(void) {
+void pseudo_random_jump_r(pseudo_random_t *random) {
+    uint64_t *state = random->state;
     static const uint64_t JUMP[] = { 0x180ec6d33cfd0aba, 0xd5a61266f0c9392c,
         0xa9582618e03fc9aa, 0x39abdc4529b1661c };
 
@@ -56,18 +84,22 @@ void pseudo_random_jump(void) {
     for(int i = 0; i < sizeof JUMP / sizeof *JUMP; i++)
         for(int b = 0; b < 64; b++) {
             if (JUMP[i] & UINT64_C(1) << b) {
-                s0 ^= pseudo_random_state[0];
-                s1 ^= pseudo_random_state[1];
-                s2 ^= pseudo_random_state[2];
-                s3 ^= pseudo_random_state[3];
+                s0 ^= state[0];
+                s1 ^= state[1];
+                s2 ^= state[2];
+                s3 ^= state[3];
             }
-            pseudo_random_next();
+            pseudo_random_next_r(random);
         }
 
-    pseudo_random_state[0] = s0;
-    pseudo_random_state[1] = s1;
-    pseudo_random_state[2] = s2;
-    pseudo_random_state[3] = s3;
+    state[0] = s0;
+    state[1] = s1;
+    state[2] = s2;
+    state[3] = s3;
+}
+
+void pseudo_random_jump(void) {
+    pseudo_random_jump_r(pseudo_random_default_state());
 }
 
 /* This is the long-jump function for the generator. It is equivalent to 2^192
@@ -75,7 +107,8 @@ void pseudo_random_jump(void) {
    points, from each of which jump() will generate 2^64 non-overlapping
    subsequences for parallel distributed computations. */
 
-void pseudo_random_long_jump(void) {
+void pseudo_random_long_jump_r(pseudo_random_t *random) {
+    uint64_t *state = random->state;
     static const uint64_t LONG_JUMP[] = { 0x76e15d3efefdcbbf,
         0xc5004e441c522fb3, 0x77710069854ee241, 0x39109bb02acbe635 };
 
@@ -86,28 +119,28 @@ void pseudo_random_long_jump(void) {
     for(int i = 0; i < sizeof LONG_JUMP / sizeof *LONG_JUMP; i++)
         for(int b = 0; b < 64; b++) {
             if (LONG_JUMP[i] & UINT64_C(1) << b) {
-                s0 ^= pseudo_random_state[0];
-                s1 ^= pseudo_random_state[1];
-                s2 ^= pseudo_random_state[2];
-                s3 ^= pseudo_random_state[3];
+                s0 ^= state[0];
+                s1 ^= state[1];
+                s2 ^= state[2];
+                s3 ^= state[3];
             }
-            pseudo_random_next();
+            pseudo_random_next_r(random);
         }
 
-    pseudo_random_state[0] = s0;
-    pseudo_random_state[1] = s1;
-    pseudo_random_state[2] = s2;
-    pseudo_random_state[3] = s3;
+    state[0] = s0;
+    state[1] = s1;
+    state[2] = s2;
+    state[3] = s3;
+}
+
+void pseudo_random_long_jump(void) {
+    pseudo_random_long_jump_r(pseudo_random_default_state());
 }
 
-/* Code slightly adapted from Blackman and Vigna's, using a local static state.
-   First call should have the seed value, and subsequent calls should set seed
-   to zero. Since local static variables are initialized to 0, the code always
-   works predictably, even when the first seed is 0 */
-uint64_t _pseudo_random_splitmix64(uint64_t seed) {
-    static uint64_t x;
-    if (seed>0) x=seed;
-    uint64_t z = (x += 0x9e3779b97f4a7c15);
+/* Code slightly adapted from Blackman and Vigna's, advancing a state given by
+   the caller */
+static uint64_t pseudo_random_splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15);
     z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
     z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
     return z ^ (z >> 31);
@@ -115,9 +148,63 @@ uint64_t _pseudo_random_splitmix64(uint64_t seed) {
 
 /* This code, not from Blackman and Vigna's, implements the state
    initialization they recommend */
+void pseudo_random_seed_r(pseudo_random_t *random, uint64_t seed) {
+    uint64_t x = seed;
+    for (int i=0; i<4; i++) {
+        random->state[i] = pseudo_random_splitmix64(&x);
+    }
+}
+
 void pseudo_random_seed(uint64_t seed) {
-    pseudo_random_state[0] = _pseudo_random_splitmix64(seed);
-    pseudo_random_state[1] = _pseudo_random_splitmix64(0);
-    pseudo_random_state[2] = _pseudo_random_splitmix64(0);
-    pseudo_random_state[3] = _pseudo_random_splitmix64(0);
+    pseudo_random_seed_r(&pseudo_random_default, seed);
+    pseudo_random_default_seeded = true;
+}
+
+/* This code, not from Blackman and Vigna's, runs their generator in lanes.
+   The multiplications by 5 and 9 are written as shifts, as AVX2 has no
+   64-bit multiplication; the loop over the lanes is vectorized for each
+   instruction set, and the best one is picked when the program loads. */
+
+void pseudo_random_lanes_init_r(pseudo_random_lanes_t *lanes, pseudo_random_t *random) {
+    for (int i=0; i<Pseudo_random_lanes; i++) {
+        for (int w=0; w<4; w++) lanes->state[w][i] = random->state[w];
+        pseudo_random_jump_r(random);
+    }
+}
+
+void pseudo_random_lanes_init(pseudo_random_lanes_t *lanes) {
+    pseudo_random_lanes_init_r(lanes, pseudo_random_default_state());
+}
+
+__attribute__((target_clones("avx512f", "avx2", "default")))
+void pseudo_random_lanes_fill(pseudo_random_lanes_t *lanes, uint64_t *buffer, size_t n) {
+    uint64_t s0[Pseudo_random_lanes], s1[Pseudo_random_lanes],
+             s2[Pseudo_random_lanes], s3[Pseudo_random_lanes];
+    for (int i=0; i<Pseudo_random_lanes; i++) {
+        s0[i] = lanes->state[0][i];
+        s1[i] = lanes->state[1][i];
+        s2[i] = lanes->state[2][i];
+        s3[i] = lanes->state[3][i];
+    }
+    for (size_t j=0; j<n; j+=Pseudo_random_lanes) {
+        for (int i=0; i<Pseudo_random_lanes; i++) {
+            const uint64_t times5 = s1[i] + (s1[i] << 2);
+            const uint64_t rotated = (times5 << 7) | (times5 >> 57);
+            buffer[j+i] = rotated + (rotated << 3);
+
+            const uint64_t t = s1[i] << 17;
+            s2[i] ^= s0[i];
+            s3[i] ^= s1[i];
+            s1[i] ^= s2[i];
+            s0[i] ^= s3[i];
+            s2[i] ^= t;
+            s3[i] = (s3[i] << 45) | (s3[i] >> 19);
+        }
+    }
+    for (int i=0; i<Pseudo_random_lanes; i++) {
+        lanes->state[0][i] = s0[i];
+        lanes->state[1][i] = s1[i];
+        lanes->state[2][i] = s2[i];
+        lanes->state[3][i] = s3[i];
+    }
 }
@@ -6,27 +6,62 @@
 #ifndef PSEUDO_RANDOM_H
 #define PSEUDO_RANDOM_H
 
+#include <stddef.h>
 #include <stdint.h>
 
+/* The state of a generator. Each state fills a cache line of its own, so
+   threads working on neighboring states do not slow each other down. The
+   functions ending in _r work on an explicit state; the others on a default
+   state, one per thread. A thread that uses its default state unseeded gets
+   a fixed seed plus the number of threads that did so before it. */
+
+typedef struct pseudo_random_t {
+    _Alignas(64) uint64_t state[4];
+} pseudo_random_t;
+
 /* This is xoshiro256** 1.0, a rock-solid pseudo-random generators. It has
    excellent (sub-ns) speed, a state (256 bits) that is large enough for any
    parallel application, and it passes all known tests of pseudo-randomness */
 
 uint64_t pseudo_random_next(void);
+uint64_t pseudo_random_next_r(pseudo_random_t *random);
 
 /* Jump function for the generator. It is equivalent to 2^128 calls to
    pseudo_random_next(); it can be used to generate 2^128 non-overlapping
    subsequences for parallel computations. */
 
 void pseudo_random_jump(void);
+void pseudo_random_jump_r(pseudo_random_t *random);
 
 /* Long-jump function for the generator. It is equivalent to 2^192
    calls to pseudo_random_next(); it can be used to generate 2^64 starting
    points, from each of which pseudo_random_jump() will generate 2^64
    non-overlapping subsequences for parallel distributed computations. */
 void pseudo_random_long_jump(void);
+void pseudo_random_long_jump_r(pseudo_random_t *random);
 
 /* Recommended initialization of the 256-bit state from a 64-bit seed */
 void pseudo_random_seed(uint64_t seed);
+void pseudo_random_seed_r(pseudo_random_t *random, uint64_t seed);
+
+/* Bulk generation: Pseudo_random_lanes xoshiro256** streams run side by side,
+   in the lanes of the vector registers, and fill whole buffers at a time */
+
+#define Pseudo_random_lanes 8
+
+typedef struct pseudo_random_lanes_t {
+    _Alignas(64) uint64_t state[4][Pseudo_random_lanes];
+} pseudo_random_lanes_t;
+
+/* Starts the lanes from the state of a generator: lane i takes the
+   subsequence after i jumps. The generator is left Pseudo_random_lanes jumps
+   ahead, past all the lanes. */
+void pseudo_random_lanes_init(pseudo_random_lanes_t *lanes);
+void pseudo_random_lanes_init_r(pseudo_random_lanes_t *lanes, pseudo_random_t *random);
+
+/* Fills the buffer with n numbers, n being a multiple of Pseudo_random_lanes;
+   the lanes are interleaved: buffer[j*Pseudo_random_lanes + i] is the j-th
+   number of lane i */
+void pseudo_random_lanes_fill(pseudo_random_lanes_t *lanes, uint64_t *buffer, size_t n);
 
 #endif
@@ -0,0 +1,86 @@
+/* Regression test of the segmented sieve
+
+   Sieves a few ranges with segments much smaller and much larger than the
+   square root of their end, and compares the count and the sum of the
+   primes found with those of a plain sieve of Eratosthenes over the whole
+   range. The small segments send most sieving primes past the ring of
+   buckets, and with the largest primes some of their steps too; the ranges
+   far above 0 start the sieving primes at multiples other than their
+   squares. */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "prime-sieve.h"
+
+typedef struct range_t {
+    uint64_t lo, hi;
+} range_t;
+
+static const range_t Ranges[] = {
+    { 0, 10000000 },
+    { 10000000000, 10010000000 },
+    { 1000000000000, 1000020000000 },    // fills the longest ring of buckets
+    { 10000248000000, 10000250000000 },  // has 3162317^2
+};
+
+// Bytes per segment; 0 is the default of the machine
+static const size_t Segment_sizes[] = { 8, 64, 100, 1024, 0, 4 << 20 };
+
+#define Ranges_n        (sizeof(Ranges)/sizeof(Ranges[0]))
+#define Segment_sizes_n (sizeof(Segment_sizes)/sizeof(Segment_sizes[0]))
+
+static void add_prime(uint64_t prime, void *context) {
+    *(uint64_t *) context += prime;
+}
+
+// Counts and adds up the primes in [lo, hi) with a plain sieve
+static void plain_sieve(uint64_t lo, uint64_t hi, uint64_t *count, uint64_t *sum) {
+    uint64_t limit = 1;
+    while ((limit+1)*(limit+1) < hi) limit++;
+    bool *composite_small = calloc(limit+1, sizeof(bool));
+    bool *composite = calloc(hi-lo, sizeof(bool));
+    if (composite_small == NULL || composite == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (uint64_t p=2; p<=limit; p++) {
+        if (composite_small[p]) {
+            continue;
+        }
+        for (uint64_t m=p*p; m<=limit; m+=p) composite_small[m] = true;
+        const uint64_t start = p*p > lo ? p*p : (lo+p-1)/p*p;
+        for (uint64_t m=start; m<hi; m+=p) composite[m-lo] = true;
+    }
+    *count = *sum = 0;
+    for (uint64_t n=lo>2 ? lo : 2; n<hi; n++) {
+        if (!composite[n-lo]) {
+            (*count)++;
+            *sum += n;
+        }
+    }
+    free(composite_small);
+    free(composite);
+}
+
+int main(void) {
+    bool passed = true;
+    for (size_t r=0; r<Ranges_n; r++) {
+        const range_t *range = &Ranges[r];
+        uint64_t count, sum;
+        plain_sieve(range->lo, range->hi, &count, &sum);
+        for (size_t s=0; s<Segment_sizes_n; s++) {
+            sieve_set_segment_size(Segment_sizes[s]);
+            uint64_t sieve_sum = 0;
+            const uint64_t sieve_count = sieve_primes(range->lo, range->hi, add_prime, &sieve_sum);
+            const bool ok = sieve_count == count && sieve_sum == sum;
+            printf("[%" PRIu64 ", %" PRIu64 ") segment %zu: %" PRIu64 " primes, expected %" PRIu64 "%s\n",
+                   range->lo, range->hi, Segment_sizes[s], sieve_count, count, ok ? "" : " FAILED");
+            passed = passed && ok;
+        }
+    }
+    sieve_set_segment_size(0);
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
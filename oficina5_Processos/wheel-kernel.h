@@ -0,0 +1,4 @@
+// [[ ---------- code generated by bench-wheel.c
+// Fastest kernel of wheel.inc on the build machine: table 0.350s unrolled 0.302s simd 0.101s
+#define wheel_divisor wheel_divisor_simd
+// ---------- ]]
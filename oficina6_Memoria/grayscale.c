@@ -1,6 +1,5 @@
 /* grayscale transforms for images */
 
-#include <ctype.h>
 #include <inttypes.h>
 #include <limits.h>
 #include <math.h>
@@ -8,47 +7,7 @@
 #include <stdlib.h>
 
 #include "benchmark.h"
-
-int get_byte() {
-    int input = getchar();
-    if (input == EOF) {
-        fprintf(stderr, "unexpected EOF in byte input stream\n");
-        exit(EXIT_FAILURE);
-    }
-    return input;
-}
-
-int get_word() {
-    int input_most  = getchar();
-    int input_least = getchar();
-    if (input_most == EOF || input_least == EOF) {
-        fprintf(stderr, "unexpected EOF in word input stream\n");
-        exit(EXIT_FAILURE);
-    }
-    return (input_most << 8) | input_least;
-}
-
-void put_byte(int64_t output) {
-    int status = putchar((int) output);
-    if (status == EOF) {
-        fprintf(stderr, "error writing to output stream\n");
-        exit(EXIT_FAILURE);
-    }
-}
-
-void put_word(int64_t output) {
-    int status_most  = putchar((int) (output >> 8));
-    int status_least = putchar((int) (output & 0xFF));
-    if (status_most == EOF || status_least == EOF) {
-        fprintf(stderr, "error writing to output stream\n");
-        exit(EXIT_FAILURE);
-    }
-}
-
-void put_qword(int64_t output) {
-    put_word(output >> 16);
-    put_word(output & 0xFFFF);
-}
+#include "pnm.h"
 
 
 int main(int argc, char *argv[]) {
@@ -76,52 +35,35 @@ int main(int argc, char *argv[]) {
 
     // Reads input image...
     // ...reads and parses header...
-    const int magic_number_1 = get_byte();
-    const int magic_number_2 = get_byte();
-    if (magic_number_1!='P' || (magic_number_2!='5' && magic_number_2!='6')) {
-        fprintf(stderr, "invalid file type in header\n");
-        return EXIT_FAILURE;
-    }
-    size_t width;
-    if (scanf("%zu", &width) != 1 || width <= 0) {
-        fprintf(stderr, "invalid width in header\n");
-        return EXIT_FAILURE;
-    }
-    size_t height;
-    if (scanf("%zu", &height) != 1 || height <= 0) {
-        fprintf(stderr, "invalid width in header\n");
-        return EXIT_FAILURE;
-    }
-    int max_val;
-    if (scanf("%d", &max_val) != 1 || max_val <= 0 || max_val >= 65536) {
+    pnm_header_t header;
+    pnm_read_header(stdin, &header);
+    if (header.max_val >= 65536) {
         fprintf(stderr, "invalid max_val in header\n");
         return EXIT_FAILURE;
     }
-    const int end_of_header = get_byte();
-    if (!isspace(end_of_header)) {
-        fprintf(stderr, "invalid character terminating header\n");
+    const size_t width   = header.width;
+    const size_t height  = header.height;
+    const int    max_val = header.max_val;
+
+    // Writes output header
+    const int64_t out_bound_val = 1L << b;
+    const int64_t out_max_val   = out_bound_val - 1;
+    pnm_header_t out_header = header;
+    out_header.magic_number_2 = '5';
+    out_header.channels       = 1;
+    out_header.max_val        = out_max_val;
+    out_header.bytes          = pnm_bytes(out_max_val);
+    pnm_write_header(&out_header);
+
+    // ..allocates memory in the heap, for a row at a time
+    uint32_t *input_row  = malloc(width*3*sizeof(uint32_t));
+    uint32_t *output_row = malloc(width*sizeof(uint32_t));
+    if (input_row == NULL || output_row == NULL) {
+        fprintf(stderr, "not enough memory\n");
         return EXIT_FAILURE;
     }
-    const int bytes = max_val < 256 ? 1 : 2;
 
-    // Writes output header
-    const int     out_magic_number_2 = '5';
-    const int64_t out_bound_val      = 1L << b;
-    const int64_t out_max_val        = out_bound_val - 1;
-    const int64_t out_bytes          = b/8 + (b%8 != 0 ? 1 : 0);
-    put_byte(magic_number_1);
-    put_byte(out_magic_number_2);
-    put_byte('\n');
-    printf("%zu %zu\n", width, height);
-    printf("%" PRId64, out_max_val);
-    put_byte(end_of_header);
-
-    int  (* const get_pixel)(void) = bytes == 1 ? get_byte : get_word;
-    void (* const put_pixel)(int64_t) =  out_bytes == 1 ? put_byte :
-                                        (out_bytes == 2 ? put_word : put_qword);
-
-    // Inputs, processes, and outputs image
-    const size_t pixels_n = height*width;
+    // Inputs, processes, and outputs image, a row at a time
 
     // No colorspace consideration, just averages the colors
     // #define TRANSFER_TO_LINEAR(v) (v)
@@ -163,22 +105,27 @@ int main(int argc, char *argv[]) {
     #define LUMINANCE_G_COEF (0.587f)
     #define LUMINANCE_B_COEF (0.114f)
 
-    for (size_t data=0; data<pixels_n; data++) {
-        float input_r = ((float) get_pixel()) / max_val;
-        float input_g = ((float) get_pixel()) / max_val;
-        float input_b = ((float) get_pixel()) / max_val;
-        float linear_r = TRANSFER_TO_LINEAR(input_r);
-        float linear_g = TRANSFER_TO_LINEAR(input_g);
-        float linear_b = TRANSFER_TO_LINEAR(input_b);
-        float linear_gray = LUMINANCE_R_COEF*linear_r +
-                            LUMINANCE_G_COEF*linear_g +
-                            LUMINANCE_B_COEF*linear_b;
-        float transfer_gray = LINEAR_TO_TRANSFER(linear_gray);
-        int64_t output = (int64_t) rintf(transfer_gray*out_max_val);
-        output = output < 0           ? 0           : output;
-        output = output > out_max_val ? out_max_val : output;
-        put_pixel(output);
+    for (size_t row=0; row<height; row++) {
+        pnm_read_samples(stdin, &header, input_row, width*3);
+        for (size_t col=0; col<width; col++) {
+            float input_r = ((float) input_row[3*col  ]) / max_val;
+            float input_g = ((float) input_row[3*col+1]) / max_val;
+            float input_b = ((float) input_row[3*col+2]) / max_val;
+            float linear_r = TRANSFER_TO_LINEAR(input_r);
+            float linear_g = TRANSFER_TO_LINEAR(input_g);
+            float linear_b = TRANSFER_TO_LINEAR(input_b);
+            float linear_gray = LUMINANCE_R_COEF*linear_r +
+                                LUMINANCE_G_COEF*linear_g +
+                                LUMINANCE_B_COEF*linear_b;
+            float transfer_gray = LINEAR_TO_TRANSFER(linear_gray);
+            int64_t output = (int64_t) rintf(transfer_gray*out_max_val);
+            output = output < 0           ? 0           : output;
+            output = output > out_max_val ? out_max_val : output;
+            output_row[col] = output;
+        }
+        pnm_write_samples(&out_header, output_row, width);
     }
+    pnm_write_flush();
 
     fprintf(stderr, "total      (ns): %.0lf\n", benchmark_pop());
     fprintf(stderr, "resolution (ns): %.0lf\n", benchmark_resolution());
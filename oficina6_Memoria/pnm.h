@@ -0,0 +1,368 @@
+/* Ancillary functions to read and write PNM (PGM and PPM) images.
+
+   The header is parsed with stdio, as before; the subpixels, big-endian
+   words of 1, 2 or 4 bytes, are read and written in blocks of 1 MiB, and
+   converted from and to uint32_t by a byte shuffle (pshufb) for every 4
+   subpixels. The output header goes out with the first block, both in a
+   single writev call.
+
+   Alternatively, the input and output files are mapped into memory, and the
+   subpixels are used in place, in their own width, with no copy at all. The
+   pages are all mapped up front, so the page faults are not taken later, in
+   the middle of the processing. When the output is the input file itself,
+   it is mapped once more, shared and writable, and changed in place. */
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <immintrin.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define  PNM_BLOCK_SIZE  (1 << 20)
+// The kernels load and store 16 bytes at a time, past the end of the data
+#define  PNM_BLOCK_SLACK (16)
+
+typedef struct pnm_header_t {
+    int    magic_number_1, magic_number_2;
+    size_t width, height, channels;
+    long   max_val;
+    int    end_of_header;
+    int    bytes;          // of each subpixel: 1, 2 or 4
+} pnm_header_t;
+
+static uint8_t pnm_input_block[PNM_BLOCK_SIZE + PNM_BLOCK_SLACK];
+static uint8_t pnm_output_block[PNM_BLOCK_SIZE + PNM_BLOCK_SLACK];
+static size_t  pnm_output_used = 0;   // bytes waiting in the output block
+static char    pnm_header_text[128];
+static size_t  pnm_header_length = 0; // header waiting to go out with the block
+
+
+/* --- Conversions between big-endian words and uint32_t */
+
+// Masks of pshufb, indexed by bytes/2: decoding moves the bytes of 4 words
+// to the lowest bytes of 4 uint32_t, zeroing the others (index -1); encoding
+// moves them back
+static const int8_t pnm_decode_masks[3][16] = {
+    { 0, -1, -1, -1, 1, -1, -1, -1, 2, -1, -1, -1,  3, -1, -1, -1 },
+    { 1,  0, -1, -1, 3,  2, -1, -1, 5,  4, -1, -1,  7,  6, -1, -1 },
+    { 3,  2,  1,  0, 7,  6,  5,  4, 11, 10, 9,  8, 15, 14, 13, 12 },
+};
+static const int8_t pnm_encode_masks[3][16] = {
+    { 0,  4,  8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 1,  0,  5,  4,  9,  8, 13, 12, -1, -1, -1, -1, -1, -1, -1, -1 },
+    { 3,  2,  1,  0,  7,  6,  5,  4, 11, 10,  9,  8, 15, 14, 13, 12 },
+};
+
+static inline uint32_t pnm_decode_word(const uint8_t *input, int bytes) {
+    uint32_t sample = 0;
+    for (int byte=0; byte<bytes; byte++) {
+        sample = (sample << 8) | input[byte];
+    }
+    return sample;
+}
+
+static inline void pnm_encode_word(uint8_t *output, int bytes, uint32_t sample) {
+    for (int byte=bytes-1; byte>=0; byte--) {
+        output[byte] = sample & 0xFF;
+        sample >>= 8;
+    }
+}
+
+__attribute__((target("ssse3")))
+static inline size_t pnm_decode_ssse3(const uint8_t *input, int bytes, uint32_t *samples, size_t n) {
+    const __m128i mask = _mm_loadu_si128((const __m128i *) pnm_decode_masks[bytes/2]);
+    size_t i = 0;
+    for (; i+4<=n; i+=4) {
+        const __m128i words = _mm_loadu_si128((const __m128i *) (input + i*bytes));
+        _mm_storeu_si128((__m128i *) (samples + i), _mm_shuffle_epi8(words, mask));
+    }
+    return i;
+}
+
+__attribute__((target("ssse3")))
+static inline size_t pnm_encode_ssse3(uint8_t *output, int bytes, const uint32_t *samples, size_t n) {
+    const __m128i mask = _mm_loadu_si128((const __m128i *) pnm_encode_masks[bytes/2]);
+    size_t i = 0;
+    for (; i+4<=n; i+=4) {
+        const __m128i words = _mm_loadu_si128((const __m128i *) (samples + i));
+        _mm_storeu_si128((__m128i *) (output + i*bytes), _mm_shuffle_epi8(words, mask));
+    }
+    return i;
+}
+
+// Converts n words into samples; up to PNM_BLOCK_SLACK bytes past the words
+// may be read, but are not used
+static inline void pnm_decode(const uint8_t *input, int bytes, uint32_t *samples, size_t n) {
+    size_t i = __builtin_cpu_supports("ssse3") ? pnm_decode_ssse3(input, bytes, samples, n) : 0;
+    for (; i<n; i++) {
+        samples[i] = pnm_decode_word(input + i*bytes, bytes);
+    }
+}
+
+// Converts n samples into words; up to PNM_BLOCK_SLACK bytes past the words
+// may be overwritten
+static inline void pnm_encode(uint8_t *output, int bytes, const uint32_t *samples, size_t n) {
+    size_t i = __builtin_cpu_supports("ssse3") ? pnm_encode_ssse3(output, bytes, samples, n) : 0;
+    for (; i<n; i++) {
+        pnm_encode_word(output + i*bytes, bytes, samples[i]);
+    }
+}
+
+
+// Bytes of each subpixel, for a given max_val
+static inline int pnm_bytes(long max_val) {
+    return max_val < 256 ? 1 : (max_val < 65536 ? 2 : 4);
+}
+
+
+/* --- Input */
+
+static inline int pnm_get_byte(FILE *file) {
+    int input = getc(file);
+    if (input == EOF) {
+        fprintf(stderr, "unexpected EOF in byte input stream\n");
+        exit(EXIT_FAILURE);
+    }
+    return input;
+}
+
+// Reads and parses the header; max_val may be up to 2^32-1, or 32 bits
+static inline void pnm_read_header(FILE *file, pnm_header_t *header) {
+    header->magic_number_1 = pnm_get_byte(file);
+    header->magic_number_2 = pnm_get_byte(file);
+    if (header->magic_number_1!='P' || (header->magic_number_2!='5' && header->magic_number_2!='6')) {
+        fprintf(stderr, "invalid file type in header\n");
+        exit(EXIT_FAILURE);
+    }
+    header->channels = header->magic_number_2=='5' ? 1 : 3;
+    if (fscanf(file, "%zu", &header->width) != 1 || header->width <= 0) {
+        fprintf(stderr, "invalid width in header\n");
+        exit(EXIT_FAILURE);
+    }
+    if (fscanf(file, "%zu", &header->height) != 1 || header->height <= 0) {
+        fprintf(stderr, "invalid height in header\n");
+        exit(EXIT_FAILURE);
+    }
+    if (fscanf(file, "%ld", &header->max_val) != 1 || header->max_val <= 0 || header->max_val >= 4294967296) {
+        fprintf(stderr, "invalid max_val in header\n");
+        exit(EXIT_FAILURE);
+    }
+    header->end_of_header = pnm_get_byte(file);
+    if (!isspace(header->end_of_header)) {
+        fprintf(stderr, "invalid character terminating header\n");
+        exit(EXIT_FAILURE);
+    }
+    header->bytes = pnm_bytes(header->max_val);
+}
+
+// Reads the next n subpixels of the image
+static inline void pnm_read_samples(FILE *file, const pnm_header_t *header, uint32_t *samples, size_t n) {
+    const int    bytes   = header->bytes;
+    const size_t block_n = PNM_BLOCK_SIZE / bytes;
+    while (n > 0) {
+        const size_t words_n = n < block_n ? n : block_n;
+        if (fread(pnm_input_block, bytes, words_n, file) != words_n) {
+            fprintf(stderr, "unexpected EOF in input stream\n");
+            exit(EXIT_FAILURE);
+        }
+        pnm_decode(pnm_input_block, bytes, samples, words_n);
+        samples += words_n;
+        n -= words_n;
+    }
+}
+
+// Reads the next n subpixels of an image of 1 byte per subpixel, as they are
+static inline void pnm_read_bytes(FILE *file, uint8_t *samples, size_t n) {
+    if (fread(samples, 1, n, file) != n) {
+        fprintf(stderr, "unexpected EOF in input stream\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+/* --- Output, to stdout, which must not be written through stdio */
+
+static inline void pnm_writev(struct iovec *iov, int iov_n) {
+    while (iov_n > 0) {
+        ssize_t written = writev(STDOUT_FILENO, iov, iov_n);
+        if (written < 0) {
+            fprintf(stderr, "error writing to output stream\n");
+            exit(EXIT_FAILURE);
+        }
+        // Skips what was written, and goes on from there
+        for (; iov_n > 0 && (size_t) written >= iov->iov_len; iov++, iov_n--) {
+            written -= iov->iov_len;
+        }
+        if (iov_n > 0) {
+            iov->iov_base = (char *) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+
+// Sends the header and the block, if any is waiting
+static inline void pnm_write_flush(void) {
+    struct iovec iov[2] = {
+        { pnm_header_text,  pnm_header_length },
+        { pnm_output_block, pnm_output_used },
+    };
+    pnm_writev(iov, 2);
+    pnm_header_length = 0;
+    pnm_output_used = 0;
+}
+
+// Formats the header, to be sent with the first block of subpixels
+static inline void pnm_write_header(const pnm_header_t *header) {
+    pnm_header_length = snprintf(pnm_header_text, sizeof(pnm_header_text), "%c%c\n%zu %zu\n%ld%c",
+                                 header->magic_number_1, header->magic_number_2,
+                                 header->width, header->height,
+                                 header->max_val, header->end_of_header);
+}
+
+// Writes the next n subpixels of the image; pnm_write_flush must follow the last
+static inline void pnm_write_samples(const pnm_header_t *header, const uint32_t *samples, size_t n) {
+    const int    bytes   = header->bytes;
+    const size_t block_n = PNM_BLOCK_SIZE / bytes;
+    while (n > 0) {
+        const size_t room_n  = block_n - pnm_output_used/bytes;
+        const size_t words_n = n < room_n ? n : room_n;
+        pnm_encode(pnm_output_block + pnm_output_used, bytes, samples, words_n);
+        pnm_output_used += words_n*bytes;
+        samples += words_n;
+        n -= words_n;
+        if (pnm_output_used == block_n*bytes) {
+            pnm_write_flush();
+        }
+    }
+}
+
+// Writes the next n subpixels of an image of 1 byte per subpixel, straight
+// from the caller's memory, after the header and the block, if any is waiting
+static inline void pnm_write_bytes(const uint8_t *samples, size_t n) {
+    struct iovec iov[3] = {
+        { pnm_header_text,  pnm_header_length },
+        { pnm_output_block, pnm_output_used },
+        { (void *) samples, n },
+    };
+    pnm_writev(iov, 3);
+    pnm_header_length = 0;
+    pnm_output_used = 0;
+}
+
+
+/* --- Files mapped into memory */
+
+typedef struct pnm_map_t {
+    uint8_t *data;    // the whole file...
+    size_t   size;
+    uint8_t *samples; // ...and its subpixels, header->bytes each
+    dev_t    device;  // the file, to tell whether the output is the input
+    ino_t    inode;
+    bool     owner;   // false for an output that is its input's mapping
+} pnm_map_t;
+
+static inline void pnm_map_failed(const char *path) {
+    fprintf(stderr, "cannot map %s\n", path);
+    exit(EXIT_FAILURE);
+}
+
+// Maps the image at path, for reading, and parses its header
+static inline void pnm_map_input(const char *path, pnm_header_t *header, pnm_map_t *map) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        pnm_map_failed(path);
+    }
+    pnm_read_header(file, header);
+    const size_t offset = ftell(file);
+    struct stat status;
+    if (fstat(fileno(file), &status) != 0) {
+        pnm_map_failed(path);
+    }
+    map->size = status.st_size;
+    map->device = status.st_dev;
+    map->inode = status.st_ino;
+    map->owner = true;
+    if (map->size - offset < header->width*header->height*header->channels*header->bytes) {
+        fprintf(stderr, "unexpected EOF in input stream\n");
+        exit(EXIT_FAILURE);
+    }
+    map->data = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fileno(file), 0);
+    fclose(file);
+    if (map->data == MAP_FAILED) {
+        pnm_map_failed(path);
+    }
+    madvise(map->data, map->size, MADV_SEQUENTIAL);
+    map->samples = map->data + offset;
+}
+
+// Maps the input image again, shared and writable, as its own output: the
+// header stays, since the output has the same one
+static inline void pnm_map_in_place(const char *path, pnm_map_t *input, pnm_map_t *map) {
+    const int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        pnm_map_failed(path);
+    }
+    uint8_t *data = mmap(NULL, input->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        pnm_map_failed(path);
+    }
+    madvise(data, input->size, MADV_SEQUENTIAL);
+    munmap(input->data, input->size);
+    input->samples = data + (input->samples - input->data);
+    input->data = data;
+    *map = *input;
+    map->owner = false;
+}
+
+// Removes the output file being created, and gives up
+static inline void pnm_map_output_failed(const char *path) {
+    unlink(path);
+    pnm_map_failed(path);
+}
+
+// Creates the image at path, with the header given, and maps it for
+// writing; if path is the file of input, the image is changed in place
+static inline void pnm_map_output(const char *path, const pnm_header_t *header, pnm_map_t *input, pnm_map_t *map) {
+    struct stat status;
+    if (stat(path, &status) == 0 && status.st_dev == input->device && status.st_ino == input->inode) {
+        pnm_map_in_place(path, input, map);
+        return;
+    }
+    const int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        pnm_map_failed(path);
+    }
+    pnm_write_header(header);
+    map->size = pnm_header_length + header->width*header->height*header->channels*header->bytes;
+    if (ftruncate(fd, map->size) != 0) {
+        pnm_map_output_failed(path);
+    }
+    map->data = mmap(NULL, map->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (map->data == MAP_FAILED) {
+        pnm_map_output_failed(path);
+    }
+    map->owner = true;
+    madvise(map->data, map->size, MADV_SEQUENTIAL);
+    memcpy(map->data, pnm_header_text, pnm_header_length);
+    map->samples = map->data + pnm_header_length;
+    pnm_header_length = 0;
+}
+
+// Unmaps the image, unless it is its input's mapping; the pages written go
+// to the file
+static inline void pnm_unmap(pnm_map_t *map) {
+    if (map->owner && munmap(map->data, map->size) != 0) {
+        fprintf(stderr, "error writing to output stream\n");
+        exit(EXIT_FAILURE);
+    }
+}